@@ -0,0 +1,515 @@
+#include "client_common.hpp"
+#include "server_common.hpp"
+
+#include <openssl/crypto.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+
+/**
+ * Micro-benchmarks of the SMPC RSA Demo implementation.
+ */
+
+/**
+ * @brief Benchmark parameters.
+ */
+struct Options
+{
+    std::size_t iterations{1000};
+    std::size_t keygen_iterations{20};
+    int bits{RSA_DEFAULT_PARTIAL_MODULUS_BITS};
+    bool json{false};
+};
+
+/**
+ * @brief Result of a single benchmark.
+ */
+struct Result
+{
+    std::string name;
+    std::size_t iterations;
+    double ops_per_sec;
+    double p50_us;
+    double p99_us;
+    double allocations_per_op;
+};
+
+/**
+ * @brief Search statistics of a prime engine.
+ */
+struct Engine_result
+{
+    std::string name;
+    double candidates_per_prime;
+    double tests_per_prime;
+    double sieve_hit_rate;
+};
+
+/**
+ * @brief Keys and precomputed values of all protocol stages shared by
+ * the benchmarks.
+ */
+struct Fixture
+{
+    static const std::size_t MESSAGE_COUNT{16};
+
+    std::unique_ptr<const Client_keys> client_keys;
+    std::unique_ptr<const Client_keys> client_crt_keys;
+    std::unique_ptr<const Server_keys> server_keys;
+    std::unique_ptr<const Verifier> verifier;
+
+    std::vector<Bignum> messages;
+    std::vector<Bignum> client_shares;
+    std::vector<Bignum> client_signatures;
+    std::vector<Bignum> server_signatures;
+    std::vector<Bignum> signatures;
+};
+
+const std::size_t Fixture::MESSAGE_COUNT;
+
+/**
+ * @brief Prints the usage string.
+ *
+ * @param path relative path to the executable
+ */
+void print_usage(const std::string &path)
+{
+    std::cerr << "USAGE: " << path << " [options]\n"
+              << "\t--iterations N - Iterations of every benchmark except key "
+                 "generation (default 1000)\n"
+              << "\t--keygen-iterations N - Iterations of the key and prime "
+                 "generation\n\t\tbenchmarks (default 20)\n"
+              << "\t--bits N - Partial modulus bit length, 1024, 1536, 2048 "
+                 "or 3072\n\t\t(default 2048)\n"
+              << "\t--json - Print the results in the JSON format\n";
+}
+
+/**
+ * @brief Parses the command line parameters.
+ *
+ * @return true if all parameters are valid, false otherwise
+ */
+bool parse_options(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; i++) {
+        const std::string option = argv[i];
+
+        if (option == "--json") {
+            options.json = true;
+            continue;
+        }
+
+        if (option == "--bits" && i + 1 < argc) {
+            unsigned long long value;
+            if (!parse_number(argv[++i], RSA_MAX_PARTIAL_MODULUS_BITS,
+                        value) ||
+                    !is_supported_modulus_bits(static_cast<int>(value)))
+                return false;
+
+            options.bits = static_cast<int>(value);
+            continue;
+        }
+
+        if ((option == "--iterations" || option == "--keygen-iterations") &&
+                i + 1 < argc) {
+            // one more slot is needed by the warm-up run
+            unsigned long long value;
+            if (!parse_number(argv[++i],
+                        std::numeric_limits<std::size_t>::max() - 1, value) ||
+                    value == 0)
+                return false;
+
+            (option == "--iterations" ? options.iterations
+                                      : options.keygen_iterations) = value;
+            continue;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Generates the keys of both parties and signs the messages with
+ * every protocol stage.
+ *
+ * @param bits partial modulus bit length
+ * @return benchmark fixture
+ */
+Fixture create_fixture(int bits)
+{
+    Fixture fixture;
+
+    RSA_keys_generator client;
+    client.set_verbose(false);
+    client.set_modulus_bits(bits);
+    client.generate_RSA_keys();
+
+    fixture.client_keys = std::make_unique<const Client_keys>(
+            client.get_d1_client(), client.get_n());
+    fixture.client_crt_keys = std::make_unique<const Client_keys>(
+            client.get_d1_client(), client.get_n(),
+            std::make_unique<const Rsa_crt>(Rsa_crt::from_primes(
+                    client.get_p(), client.get_q(), client.get_d1_client())));
+
+    RSA_keys_generator server{true};
+    server.set_verbose(false);
+    server.generate_RSA_keys(client.get_n());
+
+    const Bignum n =
+            Server::multiply_and_check_moduli(client.get_n(), server.get_n());
+    fixture.server_keys = std::make_unique<const Server_keys>(
+            Server::create_keys(client.get_d1_server(), client.get_n(), server));
+    fixture.verifier = std::make_unique<const Verifier>(n);
+
+    for (std::size_t i = 0; i < Fixture::MESSAGE_COUNT; i++) {
+        Bignum m;
+        m.set_random_value(bits - 1);
+
+        Bignum y = Client::compute_signature_share(*fixture.client_keys, m);
+        if (Client::compute_signature_share(*fixture.client_crt_keys, m) != y)
+            throw std::runtime_error("Benchmark CRT signature share is "
+                                     "invalid!");
+
+        Bignum s1, s2;
+        Server::finish_client_signature(s1, *fixture.server_keys, m, y);
+        Server::compute_server_signature(s2, *fixture.server_keys, m);
+
+        Bignum s = s2;
+        Server::combine_signatures(s, *fixture.server_keys, s1);
+
+        if (!fixture.verifier->verify(m, s))
+            throw std::runtime_error("Benchmark signature is invalid!");
+
+        fixture.messages.push_back(std::move(m));
+        fixture.client_shares.push_back(std::move(y));
+        fixture.client_signatures.push_back(std::move(s1));
+        fixture.server_signatures.push_back(std::move(s2));
+        fixture.signatures.push_back(std::move(s));
+    }
+
+    return fixture;
+}
+
+/**
+ * @brief Runs the operation the given number of times after a single
+ * warm-up run and measures the latency of every run.
+ *
+ * @param name benchmark name
+ * @param iterations number of measured runs
+ * @param operation operation to be measured, gets the run index, i.e.
+ *     0 to iterations - 1 for the measured runs and iterations for the
+ *     warm-up run, so that runs consuming their inputs get their own ones
+ * @return benchmark result
+ */
+Result run_benchmark(const std::string &name, std::size_t iterations,
+        const std::function<void(std::size_t)> &operation)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<clock::duration> durations(iterations);
+    operation(iterations);
+
+    const auto allocations = Bignum::get_allocation_count();
+    const auto start = clock::now();
+
+    for (std::size_t i = 0; i < iterations; i++) {
+        const auto op_start = clock::now();
+        operation(i);
+        durations[i] = clock::now() - op_start;
+    }
+
+    const auto total = clock::now() - start;
+    const auto allocated = Bignum::get_allocation_count() - allocations;
+
+    std::sort(durations.begin(), durations.end());
+    const auto to_us = [](clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    };
+
+    return {name, iterations,
+            static_cast<double>(iterations) /
+                    std::chrono::duration<double>(total).count(),
+            to_us(durations[iterations / 2]),
+            to_us(durations[std::min(iterations - 1, iterations * 99 / 100)]),
+            static_cast<double>(allocated) / static_cast<double>(iterations)};
+}
+
+/**
+ * @brief Converts the result of a benchmark processing the given number of
+ * items per run into per-item values.
+ */
+Result per_item(Result result, std::size_t items)
+{
+    const auto count = static_cast<double>(items);
+
+    result.ops_per_sec *= count;
+    result.p50_us /= count;
+    result.p99_us /= count;
+    result.allocations_per_op /= count;
+
+    return result;
+}
+
+/**
+ * @brief Runs all benchmarks.
+ *
+ * @return results of all benchmarks
+ */
+std::vector<Result> run_benchmarks(const Options &options)
+{
+    const Fixture f = create_fixture(options.bits);
+    const Server_keys &keys = *f.server_keys;
+    const auto message = [](std::size_t i) { return i % Fixture::MESSAGE_COUNT; };
+
+    std::vector<Result> results;
+
+    results.push_back(run_benchmark(
+            "key_generation", options.keygen_iterations, [&](std::size_t) {
+                RSA_keys_generator rsa;
+                rsa.set_verbose(false);
+                rsa.set_modulus_bits(options.bits);
+                rsa.generate_RSA_keys();
+            }));
+
+    results.push_back(run_benchmark(
+            "client_sign", options.iterations, [&](std::size_t i) {
+                Client::compute_signature_share(
+                        *f.client_keys, f.messages[message(i)]);
+            }));
+
+    results.push_back(run_benchmark(
+            "client_sign_crt", options.iterations, [&](std::size_t i) {
+                Client::compute_signature_share(
+                        *f.client_crt_keys, f.messages[message(i)]);
+            }));
+
+    Bignum res;
+    results.push_back(run_benchmark(
+            "server_finish_client", options.iterations, [&](std::size_t i) {
+                const auto j = message(i);
+                Server::finish_client_signature(
+                        res, keys, f.messages[j], f.client_shares[j]);
+            }));
+
+    results.push_back(run_benchmark(
+            "server_share", options.iterations, [&](std::size_t i) {
+                Server::compute_server_signature(
+                        res, keys, f.messages[message(i)]);
+            }));
+
+    // combining is done in place, prepare the inputs of every run including
+    // the warm-up one beforehand
+    std::vector<Bignum> combined(options.iterations + 1);
+    for (std::size_t i = 0; i < combined.size(); i++)
+        combined[i] = f.server_signatures[message(i)];
+
+    results.push_back(run_benchmark(
+            "recombination", options.iterations, [&](std::size_t i) {
+                Server::combine_signatures(
+                        combined[i], keys, f.client_signatures[message(i)]);
+            }));
+
+    results.push_back(run_benchmark(
+            "server_sign", options.iterations, [&](std::size_t i) {
+                const auto j = message(i);
+                Server::compute_signature(
+                        keys, f.messages[j], f.client_shares[j]);
+            }));
+
+    // the helper thread is reused like by a daemon connection
+    const auto helper = Server::create_helper();
+    results.push_back(run_benchmark(
+            "server_sign_concurrent", options.iterations, [&](std::size_t i) {
+                const auto j = message(i);
+                Server::compute_signature_concurrently(
+                        keys, f.messages[j], f.client_shares[j], helper.get());
+            }));
+
+    results.push_back(run_benchmark(
+            "verify", options.iterations, [&](std::size_t i) {
+                const auto j = message(i);
+                if (!f.verifier->verify(f.messages[j], f.signatures[j]))
+                    throw std::runtime_error("Signature is invalid!");
+            }));
+
+    // batches of one vector pass, reported per signature
+    const std::size_t lanes = Mod_exp_batch::LANES;
+    const std::size_t batch_iterations = std::max<std::size_t>(
+            1, options.iterations / lanes);
+
+    std::vector<Bignum> batch_messages, batch_shares, batch_pairs;
+    for (std::size_t i = 0; i < lanes; i++) {
+        const auto j = message(i);
+        batch_messages.push_back(f.messages[j]);
+        batch_shares.push_back(f.client_shares[j]);
+        batch_pairs.push_back(f.messages[j]);
+        batch_pairs.push_back(f.signatures[j]);
+    }
+
+    const Result sign_batch = run_benchmark(
+            "server_sign_batch", batch_iterations, [&](std::size_t) {
+                Server::compute_signatures(keys, batch_messages, batch_shares);
+            });
+    results.push_back(per_item(sign_batch, lanes));
+
+    const Result verify_batch = run_benchmark(
+            "verify_batch", batch_iterations, [&](std::size_t) {
+                if (!f.verifier->verify_batch(batch_pairs).empty())
+                    throw std::runtime_error("Signature is invalid!");
+            });
+    results.push_back(per_item(verify_batch, lanes));
+
+    // checks of all finished client signatures, reported per signature
+    const Result fraud_check = run_benchmark(
+            "fraud_check_batch", batch_iterations, [&](std::size_t) {
+                Server::check_client_signatures(
+                        keys, f.messages, f.client_signatures);
+            });
+    results.push_back(per_item(fraud_check, Fixture::MESSAGE_COUNT));
+
+    const Result screening = run_benchmark(
+            "fraud_screening", batch_iterations, [&](std::size_t) {
+                if (Server::screen_client_signatures(keys, f.messages,
+                            f.client_signatures, 0, Fixture::MESSAGE_COUNT) !=
+                        Fixture::MESSAGE_COUNT)
+                    throw std::runtime_error("Client signature is invalid!");
+            });
+    results.push_back(per_item(screening, Fixture::MESSAGE_COUNT));
+
+    return results;
+}
+
+/**
+ * @brief Generates primes of the client key size by every prime engine.
+ *
+ * @param results benchmark results, the prime generation ones are appended
+ * @return search statistics of all engines
+ */
+std::vector<Engine_result> run_prime_benchmarks(
+        const Options &options, std::vector<Result> &results)
+{
+    const int bits = options.bits / 2;
+
+    Bignum low, high;
+    low.set_bit(bits - 1);
+    low.set_bit(bits - 2);
+    high.set_bit(bits);
+
+    std::vector<Engine_result> engines;
+    for (const char *name : {"sieve", "random", "openssl"}) {
+        const auto engine = Prime_engine::create(name);
+
+        Bignum prime;
+        results.push_back(run_benchmark(std::string("prime_") + name,
+                options.keygen_iterations, [&](std::size_t) {
+                    engine->generate_prime(prime, RSA_PUBLIC_EXP, low, high);
+                }));
+
+        const Prime_statistics stats = engine->get_statistics();
+        const auto primes = static_cast<double>(stats.primes);
+        engines.push_back({name,
+                static_cast<double>(stats.candidates) / primes,
+                static_cast<double>(stats.primality_tests) / primes,
+                stats.sieve_hit_rate()});
+    }
+
+    return engines;
+}
+
+/**
+ * @brief Prints the results as a table.
+ */
+void print_table(int bits, const std::vector<Result> &results,
+        const std::vector<Engine_result> &engines)
+{
+    std::cout << "OpenSSL: " << OpenSSL_version(OPENSSL_VERSION) << '\n'
+              << "Partial modulus: " << bits << " bits\n"
+              << "Mod_exp_batch kernel: " << Mod_exp_batch::get_kernel_name()
+              << '\n'
+              << std::left << std::setw(22) << "benchmark" << std::right
+              << std::setw(12) << "iterations" << std::setw(14) << "ops/s"
+              << std::setw(14) << "p50 [us]" << std::setw(14) << "p99 [us]"
+              << std::setw(12) << "allocs/op" << '\n'
+              << std::fixed << std::setprecision(1);
+
+    for (const auto &r : results)
+        std::cout << std::left << std::setw(22) << r.name << std::right
+                  << std::setw(12) << r.iterations << std::setw(14)
+                  << r.ops_per_sec << std::setw(14) << r.p50_us << std::setw(14)
+                  << r.p99_us << std::setw(12) << r.allocations_per_op << '\n';
+
+    std::cout << '\n'
+              << std::left << std::setw(22) << "prime engine" << std::right
+              << std::setw(14) << "cands/prime" << std::setw(14)
+              << "tests/prime" << std::setw(14) << "sieved [%]" << '\n';
+
+    for (const auto &e : engines)
+        std::cout << std::left << std::setw(22) << e.name << std::right
+                  << std::setw(14) << e.candidates_per_prime << std::setw(14)
+                  << e.tests_per_prime << std::setw(14)
+                  << 100 * e.sieve_hit_rate << '\n';
+}
+
+/**
+ * @brief Prints the results in the JSON format.
+ */
+void print_json(int bits, const std::vector<Result> &results,
+        const std::vector<Engine_result> &engines)
+{
+    std::cout << "{\"openssl\": \"" << OpenSSL_version(OPENSSL_VERSION)
+              << "\", \"partial_modulus_bits\": " << bits
+              << ", \"mod_exp_batch_kernel\": \""
+              << Mod_exp_batch::get_kernel_name() << '"'
+              << ", \"results\": [" << std::fixed << std::setprecision(3);
+
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        std::cout << (i == 0 ? "" : ", ") << "{\"name\": \"" << r.name
+                  << "\", \"iterations\": " << r.iterations
+                  << ", \"ops_per_sec\": " << r.ops_per_sec
+                  << ", \"p50_us\": " << r.p50_us
+                  << ", \"p99_us\": " << r.p99_us
+                  << ", \"allocations_per_op\": " << r.allocations_per_op
+                  << '}';
+    }
+
+    std::cout << "], \"prime_engines\": [";
+    for (std::size_t i = 0; i < engines.size(); i++) {
+        const auto &e = engines[i];
+        std::cout << (i == 0 ? "" : ", ") << "{\"name\": \"" << e.name
+                  << "\", \"candidates_per_prime\": "
+                  << e.candidates_per_prime
+                  << ", \"tests_per_prime\": " << e.tests_per_prime
+                  << ", \"sieve_hit_rate\": " << e.sieve_hit_rate << '}';
+    }
+
+    std::cout << "]}\n";
+}
+
+/**
+ * @brief Main function of the benchmark.
+ */
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        auto results = run_benchmarks(options);
+        const auto engines = run_prime_benchmarks(options, results);
+        options.json ? print_json(options.bits, results, engines)
+                     : print_table(options.bits, results, engines);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,293 @@
+#include "bignum_file.hpp"
+#include "instrumentation.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+const char BINARY_MAGIC[] = {'S', 'M', 'P', 'C'};
+const unsigned char BINARY_VERSION = 1;
+
+/**
+ * @brief Computes the CRC-32 (IEEE 802.3) checksum of the data. Passing
+ * the checksum of the preceding data continues its computation.
+ */
+std::uint32_t crc32(
+        const unsigned char *data, std::size_t length, std::uint32_t crc = 0)
+{
+    static const auto table = []() {
+        std::array<std::uint32_t, 256> res{};
+
+        for (std::uint32_t i = 0; i < res.size(); i++) {
+            std::uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++)
+                c = c & 1u ? 0xEDB88320u ^ (c >> 1u) : c >> 1u;
+            res[i] = c;
+        }
+
+        return res;
+    }();
+
+    crc ^= 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xFFu] ^ (crc >> 8u);
+
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void append_uint(std::string &out, std::uint32_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFFu));
+}
+
+std::uint32_t read_uint(const unsigned char *in, int bytes)
+{
+    std::uint32_t res = 0;
+    for (int i = 0; i < bytes; i++)
+        res = (res << 8u) | in[i];
+
+    return res;
+}
+
+std::string to_binary(
+        const std::vector<std::reference_wrapper<const Bignum>> &numbers)
+{
+    std::string out(std::begin(BINARY_MAGIC), std::end(BINARY_MAGIC));
+    out.push_back(static_cast<char>(BINARY_VERSION));
+    append_uint(out, static_cast<std::uint32_t>(numbers.size()), 4);
+
+    for (const Bignum &num : numbers) {
+        const std::size_t length = num.num_bytes();
+        if (num.is_negative() ||
+                length > std::numeric_limits<std::uint16_t>::max())
+            throw std::runtime_error(
+                    "Number cannot be stored in the binary format.");
+
+        append_uint(out, static_cast<std::uint32_t>(length), 2);
+        out.resize(out.size() + length);
+
+        auto *bytes = reinterpret_cast<unsigned char *>(&out[0]);
+        num.to_bytes(bytes + out.size() - length, length);
+    }
+
+    const auto *data = reinterpret_cast<const unsigned char *>(out.data());
+    append_uint(out, crc32(data, out.size()), 4);
+    return out;
+}
+
+std::vector<Bignum> from_binary(const std::string &in)
+{
+    const auto *data = reinterpret_cast<const unsigned char *>(in.data());
+    const std::size_t header = sizeof(BINARY_MAGIC) + 1 + 4;
+
+    if (in.size() < header + 4)
+        throw std::runtime_error("Truncated binary file.");
+
+    if (data[sizeof(BINARY_MAGIC)] != BINARY_VERSION)
+        throw std::runtime_error("Unsupported binary file version.");
+
+    const std::size_t end = in.size() - 4;
+    if (crc32(data, end) != read_uint(data + end, 4))
+        throw std::runtime_error("Binary file checksum mismatch.");
+
+    const std::uint32_t count = read_uint(data + header - 4, 4);
+    std::vector<Bignum> numbers;
+    numbers.reserve(std::min<std::size_t>(count, end / 2));
+
+    std::size_t pos = header;
+    for (std::uint32_t i = 0; i < count; i++) {
+        if (end - pos < 2)
+            throw std::runtime_error("Truncated binary file.");
+
+        const std::size_t length = read_uint(data + pos, 2);
+        pos += 2;
+
+        if (end - pos < length)
+            throw std::runtime_error("Truncated binary file.");
+
+        numbers.emplace_back();
+        numbers.back().set(data + pos, length);
+        pos += length;
+    }
+
+    if (pos != end)
+        throw std::runtime_error("Unexpected data in binary file.");
+
+    return numbers;
+}
+
+std::vector<Bignum> from_hex(const std::string &in)
+{
+    const char *const whitespace = " \t\n\v\f\r";
+    std::vector<Bignum> numbers;
+
+    for (std::size_t begin = in.find_first_not_of(whitespace);
+            begin != std::string::npos;
+            begin = in.find_first_not_of(whitespace, begin)) {
+        const std::size_t end = in.find_first_of(whitespace, begin);
+        const std::string token = in.substr(begin, end - begin);
+
+        try {
+            numbers.emplace_back(token, true);
+        } catch (const std::runtime_error &) {
+            throw std::runtime_error("Could not read number " +
+                                     std::to_string(numbers.size() + 1) + ".");
+        }
+
+        begin = end;
+    }
+
+    return numbers;
+}
+
+}    // namespace
+
+void write_bignums(std::ostream &out,
+        const std::vector<std::reference_wrapper<const Bignum>> &numbers,
+        File_format format)
+{
+    TIME_STAGE(OUTPUT);
+
+    if (format == File_format::BINARY) {
+        const std::string data = to_binary(numbers);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return;
+    }
+
+    for (const Bignum &num : numbers)
+        out << num << '\n';
+}
+
+std::vector<Bignum> read_all_bignums(std::istream &in)
+{
+    std::string data;
+    {
+        TIME_STAGE(FILE_LOAD);
+        data.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+    }
+
+    if (in.bad())
+        throw std::runtime_error("Could not read the input.");
+
+    TIME_STAGE(PARSE);
+
+    if (data.compare(0, sizeof(BINARY_MAGIC), BINARY_MAGIC,
+                sizeof(BINARY_MAGIC)) == 0)
+        return from_binary(data);
+
+    return from_hex(data);
+}
+
+Bignum_reader::Bignum_reader(std::istream &in)
+    : in(in), format(File_format::HEX)
+{
+    // hex files cannot contain the first letter of the magic
+    if (in.peek() != BINARY_MAGIC[0])
+        return;
+
+    format = File_format::BINARY;
+
+    unsigned char header[sizeof(BINARY_MAGIC) + 1 + 4];
+    read_bytes(header, sizeof(header));
+    crc = crc32(header, sizeof(header));
+
+    if (!std::equal(std::begin(BINARY_MAGIC), std::end(BINARY_MAGIC), header))
+        throw std::runtime_error("Unknown file format.");
+
+    if (header[sizeof(BINARY_MAGIC)] != BINARY_VERSION)
+        throw std::runtime_error("Unsupported binary file version.");
+
+    remaining = read_uint(header + sizeof(BINARY_MAGIC) + 1, 4);
+}
+
+std::size_t Bignum_reader::read(std::vector<Bignum> &numbers, std::size_t count)
+{
+    TIME_STAGE(PARSE);
+
+    std::size_t i = 0;
+    for (; i < count && !finished; i++) {
+        Bignum num;
+        if (!(format == File_format::BINARY ? read_binary(num)
+                                            : read_hex(num))) {
+            finished = true;
+            break;
+        }
+
+        numbers.push_back(std::move(num));
+        read_count++;
+    }
+
+    return i;
+}
+
+bool Bignum_reader::read_hex(Bignum &num)
+{
+    std::string token;
+    if (!(in >> token)) {
+        if (in.bad())
+            throw std::runtime_error("Could not read the input.");
+
+        return false;
+    }
+
+    try {
+        num.set(token, true);
+    } catch (const std::runtime_error &) {
+        throw std::runtime_error(
+                "Could not read number " + std::to_string(read_count + 1) + ".");
+    }
+
+    return true;
+}
+
+bool Bignum_reader::read_binary(Bignum &num)
+{
+    if (remaining == 0) {
+        check_trailer();
+        return false;
+    }
+
+    unsigned char length_bytes[2];
+    read_bytes(length_bytes, sizeof(length_bytes));
+    crc = crc32(length_bytes, sizeof(length_bytes), crc);
+
+    buffer.resize(read_uint(length_bytes, 2));
+    read_bytes(buffer.data(), buffer.size());
+    crc = crc32(buffer.data(), buffer.size(), crc);
+
+    num.set(buffer.data(), buffer.size());
+    remaining--;
+    return true;
+}
+
+void Bignum_reader::read_bytes(unsigned char *bytes, std::size_t length)
+{
+    in.read(reinterpret_cast<char *>(bytes),
+            static_cast<std::streamsize>(length));
+
+    if (in.bad())
+        throw std::runtime_error("Could not read the input.");
+
+    if (static_cast<std::size_t>(in.gcount()) != length)
+        throw std::runtime_error("Truncated binary file.");
+}
+
+void Bignum_reader::check_trailer()
+{
+    unsigned char trailer[4];
+    read_bytes(trailer, sizeof(trailer));
+
+    if (crc != read_uint(trailer, 4))
+        throw std::runtime_error("Binary file checksum mismatch.");
+
+    if (in.peek() != std::istream::traits_type::eof())
+        throw std::runtime_error("Unexpected data in binary file.");
+}
@@ -0,0 +1,85 @@
+#ifndef BIGNUM_FILE_HPP
+#define BIGNUM_FILE_HPP
+
+#include "bignum_wrapper.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+/**
+ * @brief Format of the key and signature files.
+ *
+ * HEX files contain whitespace separated hexadecimal numbers.
+ *
+ * BINARY files (version 1) consist of the magic "SMPC", one byte version,
+ * 32-bit number count, every number as 16-bit byte length followed by its
+ * big-endian magnitude, and the CRC-32 of all preceding bytes. All integers
+ * are stored in the big-endian byte order.
+ */
+enum class File_format { HEX, BINARY };
+
+/**
+ * @brief Writes the numbers to the stream in the given format.
+ *
+ * @param out output stream
+ * @param numbers numbers to be written
+ * @param format file format
+ * @throws std::runtime_error if a number cannot be stored in the format
+ */
+void write_bignums(std::ostream &out,
+        const std::vector<std::reference_wrapper<const Bignum>> &numbers,
+        File_format format);
+
+/**
+ * @brief Reads all numbers from the stream. The file format is detected
+ * automatically.
+ *
+ * @param in input stream
+ * @return read numbers
+ * @throws std::runtime_error if the input is malformed
+ */
+std::vector<Bignum> read_all_bignums(std::istream &in);
+
+/**
+ * @brief Reads numbers from a stream in chunks, so that files which do not
+ * fit into memory can be processed. The file format is detected
+ * automatically, the checksum of a binary file is checked once its last
+ * number has been read.
+ */
+class Bignum_reader
+{
+    std::istream &in;
+    File_format format;
+    std::uint32_t remaining{0};
+    std::uint32_t crc{0};
+    std::size_t read_count{0};
+    bool finished{false};
+    std::vector<unsigned char> buffer;
+
+public:
+    /**
+     * @param in input stream, must outlive the reader
+     * @throws std::runtime_error if the binary header is malformed
+     */
+    explicit Bignum_reader(std::istream &in);
+
+    /**
+     * @brief Appends at most count following numbers to the vector.
+     *
+     * @param numbers vector the numbers are appended to
+     * @param count maximal number of read numbers
+     * @return number of read numbers, 0 once the whole input has been read
+     * @throws std::runtime_error if the input is malformed
+     */
+    std::size_t read(std::vector<Bignum> &numbers, std::size_t count);
+
+private:
+    bool read_hex(Bignum &num);
+    bool read_binary(Bignum &num);
+    void read_bytes(unsigned char *bytes, std::size_t length);
+    void check_trailer();
+};
+
+#endif    // BIGNUM_FILE_HPP
@@ -19,12 +19,49 @@ Bignum_CTX::~Bignum_CTX()
     BN_CTX_free(value);
 }
 
+/******************************************
+ * Bignum_mont_CTX wrapper implementation *
+ *****************************************/
+
+Bignum_mont_CTX::Bignum_mont_CTX(const Bignum &modulus, Bignum_CTX &ctx)
+    : modulus(modulus), value(BN_MONT_CTX_new())
+{
+    handle_error(value);
+
+    if (!BN_MONT_CTX_set(value, this->modulus.get(), ctx.get())) {
+        BN_MONT_CTX_free(value);
+        handle_error(false);
+    }
+}
+
+Bignum_mont_CTX::Bignum_mont_CTX(Bignum_mont_CTX &&other) noexcept
+    : modulus(std::move(other.modulus)), value(other.value)
+{
+    other.value = nullptr;
+}
+
+const Bignum &Bignum_mont_CTX::get_modulus() const
+{
+    return modulus;
+}
+
+BN_MONT_CTX *Bignum_mont_CTX::get() const
+{
+    return value;
+}
+
+Bignum_mont_CTX::~Bignum_mont_CTX()
+{
+    BN_MONT_CTX_free(value);
+}
+
 /*********************************
  * Bignum wrapper implementation *
  ********************************/
 
-// Initialisation of a static member of the Bignum class
-Bignum_CTX Bignum::ctx;
+// Initialisation of static members of the Bignum class
+thread_local Bignum_CTX Bignum::ctx;
+thread_local unsigned long Bignum::allocation_count{0};
 
 std::ostream &operator<<(std::ostream &os, const Bignum &bn)
 {
@@ -101,15 +138,13 @@ Bignum operator-(const Bignum &a, const Bignum &b)
 
 Bignum operator*(const Bignum &a, const Bignum &b)
 {
-    Bignum r;
-    handle_error(BN_mul(r.get(), a.get(), b.get(), Bignum::ctx.get()));
-
-    return r;
+    return Bignum::mul(a, b);
 }
 
 Bignum::Bignum() : value(BN_secure_new())
 {
     handle_error(value);
+    allocation_count++;
 }
 
 Bignum::Bignum(unsigned long word) : Bignum()
@@ -130,11 +165,18 @@ Bignum::Bignum(const std::string &word, bool is_hex) : Bignum()
 Bignum::Bignum(const Bignum &other) : value(BN_dup(other.get()))
 {
     handle_error(value);
+    allocation_count++;
 }
 
 Bignum::Bignum(const BIGNUM *other) : value(BN_dup(other))
 {
     handle_error(value);
+    allocation_count++;
+}
+
+Bignum::Bignum(Bignum &&other) noexcept : value(other.value)
+{
+    other.value = nullptr;
 }
 
 Bignum &Bignum::operator=(Bignum other)
@@ -143,7 +185,7 @@ Bignum &Bignum::operator=(Bignum other)
     return *this;
 }
 
-void Bignum::swap(Bignum &other)
+void Bignum::swap(Bignum &other) noexcept
 {
     std::swap(value, other.value);
 }
@@ -158,35 +200,185 @@ const BIGNUM *Bignum::get() const
     return value;
 }
 
+void Bignum::set_bit(int bit)
+{
+    handle_error(BN_set_bit(value, bit));
+}
+
 void Bignum::set_random_value(int bits)
 {
     handle_error(BN_rand(value, bits, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY));
 }
 
+void Bignum::set_random_range(const Bignum &range)
+{
+    handle_error(BN_priv_rand_range(value, range.get()));
+}
+
+void Bignum::set_random_prime_candidate(int bits)
+{
+    // top two bits set => product of two such numbers has exactly 2 * bits
+    handle_error(BN_priv_rand(value, bits, BN_RAND_TOP_TWO, BN_RAND_BOTTOM_ODD));
+}
+
 bool Bignum::check_num_bits(int length) const
 {
     return BN_num_bits(value) == length;
 }
 
+int Bignum::num_bits() const
+{
+    return BN_num_bits(value);
+}
+
 bool Bignum::is_one() const
 {
     return BN_is_one(value);
 }
 
-void Bignum::mod(const Bignum &mod)
+bool Bignum::is_odd() const
+{
+    return BN_is_odd(value);
+}
+
+bool Bignum::is_negative() const
+{
+    return BN_is_negative(value);
+}
+
+bool Bignum::is_prime(Bignum_CTX &ctx) const
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    const int res = BN_check_prime(value, ctx.get(), nullptr);
+#else
+    const int res = BN_is_prime_fasttest_ex(
+            value, BN_prime_checks, ctx.get(), 1, nullptr);
+#endif
+    handle_error(res != -1);
+
+    return res == 1;
+}
+
+unsigned long Bignum::mod_word(unsigned long word) const
+{
+    const BN_ULONG res = BN_mod_word(value, word);
+    handle_error(res != static_cast<BN_ULONG>(-1));
+
+    return res;
+}
+
+void Bignum::mod(const Bignum &mod, Bignum_CTX &ctx)
 {
     handle_error(BN_mod(value, value, mod.get(), ctx.get()));
 }
 
-Bignum Bignum::inverse(const Bignum &num, const Bignum &mod)
+void Bignum::mul_into(
+        Bignum &res, const Bignum &a, const Bignum &b, Bignum_CTX &ctx)
+{
+    handle_error(BN_mul(res.get(), a.get(), b.get(), ctx.get()));
+}
+
+void Bignum::inverse_into(
+        Bignum &res, const Bignum &num, const Bignum &mod, Bignum_CTX &ctx)
 {
-    Bignum res;
     handle_error(BN_mod_inverse(res.get(), num.get(), mod.get(), ctx.get()));
+}
+
+void Bignum::mod_mul_into(Bignum &res, const Bignum &a, const Bignum &b,
+        const Bignum &mod, Bignum_CTX &ctx)
+{
+    handle_error(BN_mod_mul(res.get(), a.get(), b.get(), mod.get(), ctx.get()));
+}
+
+void Bignum::mod_exp_into(Bignum &res, const Bignum &a, const Bignum &b,
+        const Bignum &mod, Bignum_CTX &ctx)
+{
+    handle_error(BN_mod_exp(res.get(), a.get(), b.get(), mod.get(), ctx.get()));
+}
+
+void Bignum::mod_exp_into(Bignum &res, const Bignum &a, const Bignum &b,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    handle_error(BN_mod_exp_mont(res.get(), a.get(), b.get(),
+            mont.get_modulus().get(), ctx.get(), mont.get()));
+}
+
+void Bignum::mod_exp_word_into(Bignum &res, const Bignum &a, BN_ULONG w,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    if (w == 0) {
+        res.set(1);
+        return;
+    }
+
+    int bit = BN_BITS2 - 1;
+    while (((w >> bit) & 1u) == 0)
+        bit--;
+
+    BN_CTX_start(ctx.get());
+    BIGNUM *base = BN_CTX_get(ctx.get());
+
+    // res may alias a, the base is kept separately in the Montgomery form
+    bool ok = base != nullptr &&
+            BN_to_montgomery(base, a.get(), mont.get(), ctx.get()) &&
+            BN_copy(res.get(), base) != nullptr;
+
+    while (ok && bit-- > 0) {
+        ok = BN_mod_mul_montgomery(
+                res.get(), res.get(), res.get(), mont.get(), ctx.get());
+
+        if (ok && ((w >> bit) & 1u) != 0)
+            ok = BN_mod_mul_montgomery(
+                    res.get(), res.get(), base, mont.get(), ctx.get());
+    }
+
+    ok = ok && BN_from_montgomery(res.get(), res.get(), mont.get(), ctx.get());
+
+    if (base != nullptr)
+        BN_clear(base);
+
+    BN_CTX_end(ctx.get());
+    handle_error(ok);
+}
+
+void Bignum::to_mont_into(Bignum &res, const Bignum &a,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    handle_error(BN_to_montgomery(res.get(), a.get(), mont.get(), ctx.get()));
+}
+
+void Bignum::from_mont_into(Bignum &res, const Bignum &a,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    handle_error(
+            BN_from_montgomery(res.get(), a.get(), mont.get(), ctx.get()));
+}
+
+void Bignum::mont_mul_into(Bignum &res, const Bignum &a, const Bignum &b,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    handle_error(BN_mod_mul_montgomery(
+            res.get(), a.get(), b.get(), mont.get(), ctx.get()));
+}
+
+Bignum Bignum::mul(const Bignum &a, const Bignum &b, Bignum_CTX &ctx)
+{
+    Bignum res;
+    mul_into(res, a, b, ctx);
 
     return res;
 }
 
-Bignum Bignum::gcd(const Bignum &a, const Bignum &b)
+Bignum Bignum::inverse(
+        const Bignum &num, const Bignum &mod, Bignum_CTX &ctx)
+{
+    Bignum res;
+    inverse_into(res, num, mod, ctx);
+
+    return res;
+}
+
+Bignum Bignum::gcd(const Bignum &a, const Bignum &b, Bignum_CTX &ctx)
 {
     Bignum res;
     handle_error(BN_gcd(res.get(), a.get(), b.get(), ctx.get()));
@@ -194,7 +386,8 @@ Bignum Bignum::gcd(const Bignum &a, const Bignum &b)
     return res;
 }
 
-Bignum Bignum::mod_sub(const Bignum &a, const Bignum &b, const Bignum &mod)
+Bignum Bignum::mod_sub(
+        const Bignum &a, const Bignum &b, const Bignum &mod, Bignum_CTX &ctx)
 {
     Bignum res;
     handle_error(BN_mod_sub(res.get(), a.get(), b.get(), mod.get(), ctx.get()));
@@ -202,17 +395,49 @@ Bignum Bignum::mod_sub(const Bignum &a, const Bignum &b, const Bignum &mod)
     return res;
 }
 
-Bignum Bignum::mod_exp(const Bignum &a, const Bignum &b, const Bignum &mod)
+Bignum Bignum::div(const Bignum &a, const Bignum &b, Bignum_CTX &ctx)
 {
     Bignum res;
-    handle_error(BN_mod_exp(res.get(), a.get(), b.get(), mod.get(), ctx.get()));
+    handle_error(BN_div(res.get(), nullptr, a.get(), b.get(), ctx.get()));
 
     return res;
 }
 
-void Bignum::mod_mul_self(const Bignum &a, const Bignum &mod)
+Bignum Bignum::mod_exp(
+        const Bignum &a, const Bignum &b, const Bignum &mod, Bignum_CTX &ctx)
 {
-    handle_error(BN_mod_mul(value, value, a.get(), mod.get(), ctx.get()));
+    Bignum res;
+    mod_exp_into(res, a, b, mod, ctx);
+
+    return res;
+}
+
+Bignum Bignum::mod_exp(const Bignum &a, const Bignum &b,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    Bignum res;
+    mod_exp_into(res, a, b, mont, ctx);
+
+    return res;
+}
+
+Bignum Bignum::mod_exp_word(const Bignum &a, BN_ULONG w,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    Bignum res;
+    mod_exp_word_into(res, a, w, mont, ctx);
+
+    return res;
+}
+
+void Bignum::mul_self(const Bignum &a, Bignum_CTX &ctx)
+{
+    handle_error(BN_mul(value, value, a.get(), ctx.get()));
+}
+
+void Bignum::mod_mul_self(const Bignum &a, const Bignum &mod, Bignum_CTX &ctx)
+{
+    mod_mul_into(*this, *this, a, mod, ctx);
 }
 
 void Bignum::set(unsigned long word)
@@ -230,6 +455,21 @@ void Bignum::set(const std::string &word, bool is_hex)
     handle_error(BN_dec2bn(&value, word.c_str()));
 }
 
+void Bignum::set(const unsigned char *bytes, std::size_t length)
+{
+    handle_error(BN_bin2bn(bytes, static_cast<int>(length), value));
+}
+
+std::size_t Bignum::num_bytes() const
+{
+    return static_cast<std::size_t>(BN_num_bytes(value));
+}
+
+void Bignum::to_bytes(unsigned char *bytes, std::size_t length) const
+{
+    handle_error(BN_bn2binpad(value, bytes, static_cast<int>(length)) != -1);
+}
+
 Bignum::~Bignum()
 {
     BN_clear_free(value);
@@ -261,7 +501,7 @@ Bignum &Bignum::operator-=(unsigned long a)
 
 Bignum &Bignum::operator*=(const Bignum &a)
 {
-    handle_error(BN_mul(value, value, a.get(), ctx.get()));
+    mul_self(a);
     return *this;
 }
 
@@ -299,6 +539,35 @@ Bignum Bignum::operator++(int)
     return copy;
 }
 
+unsigned long Bignum::get_allocation_count()
+{
+    return allocation_count;
+}
+
+/*******************************
+ * Bignum_scope implementation *
+ ******************************/
+
+Bignum_scope::Bignum_scope(Bignum_CTX &ctx)
+    : ctx(ctx), start(ctx.scratch_used)
+{}
+
+Bignum_scope::~Bignum_scope()
+{
+    for (std::size_t i = start; i < ctx.scratch_used; i++)
+        BN_clear(ctx.scratch[i]->get());
+
+    ctx.scratch_used = start;
+}
+
+Bignum &Bignum_scope::get()
+{
+    if (ctx.scratch_used == ctx.scratch.size())
+        ctx.scratch.push_back(std::make_unique<Bignum>());
+
+    return *ctx.scratch[ctx.scratch_used++];
+}
+
 /********************
  * Helper functions *
  *******************/
@@ -5,21 +5,38 @@
 #include <openssl/err.h>
 
 #include <iostream>
+#include <memory>
+#include <vector>
+
+class Bignum;
 
 /**
  * @brief Wrapper of `BN_CTX` structure defined in the OpenSSL library.
+ * Besides the OpenSSL temporaries, the context keeps the scratch Bignums
+ * borrowed by Bignum_scope.
  */
 class Bignum_CTX
 {
     BN_CTX *const value;
 
+    // held by pointers, so that borrowed references survive the growth
+    std::vector<std::unique_ptr<Bignum>> scratch;
+    std::size_t scratch_used{0};
+
+    friend class Bignum_scope;
+
 public:
     Bignum_CTX();
     ~Bignum_CTX();
 
+    Bignum_CTX(const Bignum_CTX &) = delete;
+    Bignum_CTX &operator=(const Bignum_CTX &) = delete;
+
     BN_CTX *get();
 };
 
+class Bignum_mont_CTX;
+
 /**
  * @brief Wrapper of the BIGNUM struct and used BIGNUM operations defined
  * in the OPENSSL library.
@@ -43,7 +60,12 @@ class Bignum
     friend Bignum operator*(const Bignum &a, const Bignum &b);
 
 public:
-    static Bignum_CTX ctx;
+    /**
+     * Each thread owns its own context, so Bignum operations may be used
+     * concurrently from several threads. Operations needing a context use
+     * this one unless a caller-supplied context is given.
+     */
+    static thread_local Bignum_CTX ctx;
 
     Bignum();
     Bignum(unsigned long word);
@@ -52,10 +74,15 @@ public:
     Bignum(const Bignum &other);
     Bignum(const BIGNUM *other);
 
+    /**
+     * A moved-from Bignum may only be assigned to or destroyed.
+     */
+    Bignum(Bignum &&other) noexcept;
+
     ~Bignum();
 
     Bignum &operator=(Bignum other);
-    void swap(Bignum &other);
+    void swap(Bignum &other) noexcept;
 
     Bignum &operator+=(const Bignum &a);
     Bignum &operator+=(unsigned long a);
@@ -69,22 +96,147 @@ public:
     Bignum operator--(int);
     Bignum operator++(int);
 
-    static Bignum inverse(const Bignum &num, const Bignum &mod);
-    static Bignum gcd(const Bignum &a, const Bignum &b);
-    static Bignum mod_sub(const Bignum &a, const Bignum &b, const Bignum &mod);
-    static Bignum mod_exp(const Bignum &a, const Bignum &b, const Bignum &mod);
-    void mod_mul_self(const Bignum &a, const Bignum &mod);
-    void mod(const Bignum &mod);
+    /**
+     * The *_into variants store the result into an existing Bignum
+     * to avoid allocating a new one. The result may alias an operand.
+     */
+    static void mul_into(Bignum &res, const Bignum &a, const Bignum &b,
+            Bignum_CTX &ctx = Bignum::ctx);
+    static void inverse_into(Bignum &res, const Bignum &num,
+            const Bignum &mod, Bignum_CTX &ctx = Bignum::ctx);
+    static void mod_mul_into(Bignum &res, const Bignum &a, const Bignum &b,
+            const Bignum &mod, Bignum_CTX &ctx = Bignum::ctx);
+    static void mod_exp_into(Bignum &res, const Bignum &a, const Bignum &b,
+            const Bignum &mod, Bignum_CTX &ctx = Bignum::ctx);
+    static void mod_exp_into(Bignum &res, const Bignum &a, const Bignum &b,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+
+    /**
+     * Exponentiation by a small public exponent, e.g. 65537, done by plain
+     * left-to-right square-and-multiply in the Montgomery domain. The base
+     * must be reduced modulo the Montgomery modulus. Not constant time,
+     * use it only with public exponents.
+     */
+    static void mod_exp_word_into(Bignum &res, const Bignum &a, BN_ULONG w,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+    static Bignum mod_exp_word(const Bignum &a, BN_ULONG w,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+
+    /**
+     * Operations in the Montgomery domain of the given modulus, operands
+     * must be reduced modulo it. mont_mul_into computes a * b * R^-1 mod n,
+     * i.e. the Montgomery form of the product of two numbers in the
+     * Montgomery form, or a product scaled by R^-1 for plain numbers.
+     */
+    static void to_mont_into(Bignum &res, const Bignum &a,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+    static void from_mont_into(Bignum &res, const Bignum &a,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+    static void mont_mul_into(Bignum &res, const Bignum &a, const Bignum &b,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+
+    static Bignum mul(
+            const Bignum &a, const Bignum &b, Bignum_CTX &ctx = Bignum::ctx);
+    static Bignum inverse(const Bignum &num, const Bignum &mod,
+            Bignum_CTX &ctx = Bignum::ctx);
+    static Bignum gcd(
+            const Bignum &a, const Bignum &b, Bignum_CTX &ctx = Bignum::ctx);
+    static Bignum mod_sub(const Bignum &a, const Bignum &b, const Bignum &mod,
+            Bignum_CTX &ctx = Bignum::ctx);
+    static Bignum div(
+            const Bignum &a, const Bignum &b, Bignum_CTX &ctx = Bignum::ctx);
+    static Bignum mod_exp(const Bignum &a, const Bignum &b, const Bignum &mod,
+            Bignum_CTX &ctx = Bignum::ctx);
+    static Bignum mod_exp(const Bignum &a, const Bignum &b,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+    void mul_self(const Bignum &a, Bignum_CTX &ctx = Bignum::ctx);
+    void mod_mul_self(
+            const Bignum &a, const Bignum &mod, Bignum_CTX &ctx = Bignum::ctx);
+    void mod(const Bignum &mod, Bignum_CTX &ctx = Bignum::ctx);
 
     BIGNUM *get();
     const BIGNUM *get() const;
 
     void set(unsigned long word);
     void set(const std::string &word, bool is_hex);
+    void set(const unsigned char *bytes, std::size_t length);
+
+    std::size_t num_bytes() const;
+    void to_bytes(unsigned char *bytes, std::size_t length) const;
 
+    void set_bit(int bit);
     void set_random_value(int bits);
+    void set_random_range(const Bignum &range);
+    void set_random_prime_candidate(int bits);
     bool check_num_bits(int length) const;
+    int num_bits() const;
     bool is_one() const;
+    bool is_odd() const;
+    bool is_negative() const;
+    bool is_prime(Bignum_CTX &ctx = Bignum::ctx) const;
+    unsigned long mod_word(unsigned long word) const;
+
+    /**
+     * @brief Returns the number of BIGNUMs allocated by Bignum constructors
+     * in the calling thread so far. The difference of two calls gives
+     * the number of allocations performed in between.
+     *
+     * @return allocation count of the calling thread
+     */
+    static unsigned long get_allocation_count();
+
+private:
+    static thread_local unsigned long allocation_count;
+};
+
+/**
+ * @brief Scratch Bignums borrowed from a Bignum_CTX in the manner of
+ * BN_CTX_start and BN_CTX_get. The Bignums are allocated by the first scope
+ * needing them and reused by the later ones, so repeated operations do not
+ * touch the secure heap. Borrowed values are wiped when the scope ends.
+ *
+ * Scopes of one context must be nested and the borrowed Bignums must not
+ * be used after the end of their scope.
+ */
+class Bignum_scope
+{
+    Bignum_CTX &ctx;
+    const std::size_t start;
+
+public:
+    explicit Bignum_scope(Bignum_CTX &ctx = Bignum::ctx);
+    ~Bignum_scope();
+
+    Bignum_scope(const Bignum_scope &) = delete;
+    Bignum_scope &operator=(const Bignum_scope &) = delete;
+
+    /**
+     * @return zero Bignum valid until the end of the scope
+     */
+    Bignum &get();
+};
+
+/**
+ * @brief Wrapper of `BN_MONT_CTX` structure defined in the OpenSSL library
+ * bound to a fixed odd modulus. The context is built once and only read
+ * afterwards, so it may be shared by several threads.
+ */
+class Bignum_mont_CTX
+{
+    Bignum modulus;
+    BN_MONT_CTX *value;
+
+public:
+    explicit Bignum_mont_CTX(
+            const Bignum &modulus, Bignum_CTX &ctx = Bignum::ctx);
+    ~Bignum_mont_CTX();
+
+    Bignum_mont_CTX(const Bignum_mont_CTX &) = delete;
+    Bignum_mont_CTX &operator=(const Bignum_mont_CTX &) = delete;
+    Bignum_mont_CTX(Bignum_mont_CTX &&other) noexcept;
+
+    const Bignum &get_modulus() const;
+    BN_MONT_CTX *get() const;
 };
 
 /**
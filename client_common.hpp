@@ -2,12 +2,227 @@
 #define CLIENT_COMMON_HPP
 
 #include "common.hpp"
+#include "key_pool.hpp"
+#include "socket_wrapper.hpp"
+
 #include <fstream>
+#include <sstream>
+
+/**
+ * @brief Client keys together with the Montgomery context of the client
+ * modulus, which is built once and reused for every signature share.
+ * The modulus bit length is taken from the modulus itself.
+ *
+ * If the CRT representation of d1_client is present, it is used instead of
+ * d1_client.
+ */
+struct Client_keys
+{
+    Bignum d1_client;
+    Bignum n;
+    int bits;
+    std::unique_ptr<const Rsa_crt> crt_d1;
+
+    Bignum_mont_CTX mont_n;
+
+    /**
+     * @throws std::runtime_exception if some Bignum operation failed
+     * @throws std::out_of_range if the modulus is not supported or the
+     *     private exponent is out of range
+     */
+    Client_keys(Bignum d1_client, Bignum n,
+            std::unique_ptr<const Rsa_crt> crt_d1 = nullptr)
+        : d1_client(std::move(d1_client)), n(std::move(n)),
+          bits(check(this->d1_client, this->n)), crt_d1(std::move(crt_d1)),
+          mont_n(this->n)
+    {}
+
+private:
+    /**
+     * @brief Checks the keys before the Montgomery context is built, so
+     * that invalid moduli are not reported as OpenSSL errors.
+     *
+     * @return partial modulus bit length
+     * @throws std::out_of_range if a check fails
+     */
+    static int check(const Bignum &d1_client, const Bignum &n)
+    {
+        const int bits = check_partial_modulus(n);
+
+        // precise check is impossible without phi(n)
+        if (d1_client >= n)
+            throw std::out_of_range("Private exponent cannot be greater than "
+                                    "or equal to the partial modulus!");
+
+        return bits;
+    }
+};
 
 class Client : public SMPC_demo
 {
+    static const std::size_t MAX_POOL_REQUEST_LENGTH{16};
+    // d1_client, d1_server, n1, p and q in hex, all of them are below n1
+    static const std::size_t MAX_POOL_REPLY_LENGTH{
+            5 * (RSA_MAX_PARTIAL_MODULUS_BITS / 4 + 1)};
+    static const std::size_t MAX_DISCARDED_INPUT{1 << 20};
+
+    int modulus_bits{RSA_DEFAULT_PARTIAL_MODULUS_BITS};
+    bool crt{false};
+
+public:
     /**
-     * @brief Generates and saves the client keys.
+     * @brief Computes the client signature share of the given message.
+     * Uses only the given context, so it may be called concurrently with
+     * distinct contexts.
+     *
+     * @param keys client keys
+     * @param m message
+     * @param ctx context used for all Bignum operations
+     * @return client signature share
+     * @throws std::runtime_exception if some Bignum operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    static Bignum compute_signature_share(const Client_keys &keys,
+            const Bignum &m, Bignum_CTX &ctx = Bignum::ctx)
+    {
+        check_message_exponent_and_modulus(
+                m, keys.d1_client, keys.n, keys.bits);
+
+        TIME_STAGE(CLIENT_EXP);
+        if (!keys.crt_d1)
+            return Bignum::mod_exp(m, keys.d1_client, keys.mont_n, ctx);
+
+        Bignum y;
+        keys.crt_d1->mod_exp_into(y, m, ctx);
+        return y;
+    }
+
+    /**
+     * @brief Provisions keys for several cards at once. The keys are taken
+     * from the key pool daemon if it runs, see serve_pool. Otherwise they
+     * are taken from a pool started for this call and refilled in the
+     * background, which starts empty, so the keys of the cards are
+     * generated in parallel rather than in advance. Keys of the i-th card
+     * (counted from 1) are saved to the indexed key files, e.g.
+     * client_card.i.key and for_server.i.key.
+     *
+     * @param count number of cards
+     * @param depth key pool depth
+     * @param jobs number of key pool refill threads, 0 means one per
+     *     hardware thread
+     * @throws std::runtime_exception if an IO problem occurs or some Bignum
+     *     operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    void provision(std::size_t count, std::size_t depth, unsigned jobs)
+    {
+        if (std::ifstream(indexed_file(CLIENT_KEYS_CLIENT_SHARE_FILE, 1)) &&
+                !regenerate_keys())
+            return;
+
+        const auto daemon = Unix_socket::connect_to(KEY_POOL_SOCKET_FILE);
+        std::unique_ptr<Key_pool> pool;
+
+        if (daemon) {
+            std::cout << "Using the key pool on " KEY_POOL_SOCKET_FILE "\n";
+        } else {
+            std::cout << "Starting key pool... " << std::flush;
+            pool = std::make_unique<Key_pool>(depth, jobs, modulus_bits);
+            std::cout << "\x1B[1;32mOK\x1B[0m"
+                      << (pool->is_memory_locked()
+                                         ? "\n"
+                                         : " (memory is not locked)\n");
+        }
+
+        for (std::size_t i = 1; i <= count; i++) {
+            std::cout << "Provisioning card " << i << "... " << std::flush;
+
+            const Client_key_shares keys =
+                    daemon ? take_pooled_keys(*daemon) : pool->pop();
+            write_keys(keys.d1_client, keys.d1_server, keys.n1, keys.p, keys.q,
+                    indexed_file(CLIENT_KEYS_CLIENT_SHARE_FILE, i),
+                    indexed_file(CLIENT_KEYS_SERVER_SHARE_FILE, i));
+
+            std::cout << "\x1B[1;32mOK\x1B[0m\n";
+        }
+    }
+
+    /**
+     * @brief Runs the key pool daemon. Its key pool lives as long as the
+     * daemon, so the keys are generated on idle cores in advance and
+     * generate and provision of other client processes take them from the
+     * pool instead of searching for primes.
+     *
+     * Keys are handed out on the KEY_POOL_SOCKET_FILE Unix socket, which
+     * only the owner may connect to. A request is a line containing "KEY",
+     * the reply is a line containing d1_client, d1_server, n1, p and q in
+     * hex separated by spaces, or "ERROR" followed by the reason. Every
+     * key is handed out only once.
+     *
+     * @param depth key pool depth
+     * @param jobs number of key pool refill threads, 0 means one per
+     *     hardware thread
+     * @param max_connections maximal number of connections served at once
+     * @throws std::runtime_exception if an IO problem occurs or some Bignum
+     *     operation failed
+     */
+    void serve_pool(
+            std::size_t depth, unsigned jobs, std::size_t max_connections)
+    {
+        std::cout << "Starting key pool... " << std::flush;
+        const auto pool = std::make_shared<Key_pool>(depth, jobs, modulus_bits);
+        std::cout << "\x1B[1;32mOK\x1B[0m"
+                  << (pool->is_memory_locked() ? "\n"
+                                               : " (memory is not locked)\n");
+
+        std::cout << "Listening on " KEY_POOL_SOCKET_FILE "... " << std::flush;
+        const Unix_socket listener =
+                Unix_socket::listen_on(KEY_POOL_SOCKET_FILE, true);
+        std::cout << "\x1B[1;32mOK\x1B[0m\n";
+
+        serve_connections(listener, max_connections,
+                [pool](Unix_socket connection) {
+                    handle_pool_connection(*pool, std::move(connection));
+                });
+    }
+
+    /**
+     * @brief Sets the bit length of the generated client modulus. The
+     * server modulus gets the same bit length.
+     *
+     * @param bits partial modulus bit length
+     * @throws std::invalid_argument if the bit length is not supported
+     */
+    void set_modulus_bits(int bits)
+    {
+        if (!is_supported_modulus_bits(bits))
+            throw std::invalid_argument("Unsupported modulus bit length: " +
+                                        std::to_string(bits));
+
+        modulus_bits = bits;
+    }
+
+    /**
+     * @brief Enables storing the CRT representation of the client share of
+     * the client private exponent together with the primes of the client
+     * modulus in the client key file. Signature shares are then computed
+     * by two half-size exponentiations. The server share is unaffected, as
+     * the server must not learn the factorisation of the client modulus.
+     *
+     * The CRT signature share is not checked, i.e. the card must be
+     * protected against fault attacks, which could reveal the primes.
+     *
+     * @param enabled whether the CRT representation should be stored
+     */
+    void set_crt(bool enabled)
+    {
+        crt = enabled;
+    }
+
+private:
+    /**
+     * @brief Generates and saves the client keys. The keys are taken from
+     * the key pool daemon if it runs, see serve_pool.
      *
      * @throws std::runtime_exception if an IO problem occurs or some Bignum
      * operation failed
@@ -15,14 +230,25 @@ class Client : public SMPC_demo
      */
     void generate_keys() override
     {
-        if (std::ifstream(CLIENT_KEYS_CLIENT_SHARE_FILE) &&
-                std::ifstream(CLIENT_KEYS_SERVER_SHARE_FILE) &&
+        if (std::ifstream(key_file(CLIENT_KEYS_CLIENT_SHARE_FILE)) &&
+                std::ifstream(key_file(CLIENT_KEYS_SERVER_SHARE_FILE)) &&
                 !regenerate_keys())
             return;
 
+        if (const auto daemon = Unix_socket::connect_to(KEY_POOL_SOCKET_FILE)) {
+            std::cout << "Taking keys from the key pool... " << std::flush;
+            const Client_key_shares keys = take_pooled_keys(*daemon);
+            std::cout << "\x1B[1;32mOK\x1B[0m\n";
+
+            save_keys(keys.d1_client, keys.d1_server, keys.n1, keys.p, keys.q);
+            return;
+        }
+
         RSA_keys_generator rsa;
+        rsa.set_modulus_bits(modulus_bits);
         rsa.generate_RSA_keys();
-        save_keys(rsa.get_d1_client(), rsa.get_d1_server(), rsa.get_n());
+        save_keys(rsa.get_d1_client(), rsa.get_d1_server(), rsa.get_n(),
+                rsa.get_p(), rsa.get_q());
     }
 
     /**
@@ -38,31 +264,31 @@ class Client : public SMPC_demo
         std::cout << "Signing... " << std::flush;
 
         // Load the keys
-        std::ifstream client_keys(CLIENT_KEYS_CLIENT_SHARE_FILE),
-                messsage_file(MESSAGE_FILE);
-        if (!client_keys || !messsage_file)
-            throw std::runtime_error("Client key has not been generated or "
-                                     "message file is missing!");
+        const Client_keys keys =
+                load_keys(key_file(CLIENT_KEYS_CLIENT_SHARE_FILE));
+
+        std::ifstream messsage_file(MESSAGE_FILE);
+        if (!messsage_file)
+            throw std::runtime_error("Message file is missing!");
 
-        Bignum d1_client, n, m;
-        client_keys >> d1_client >> n;
-        messsage_file >> m;
+        Bignum m;
+        {
+            TIME_STAGE(PARSE);
+            messsage_file >> m;
+        }
 
-        if (!client_keys || !messsage_file)
-            throw std::runtime_error(
-                    "Could not read the client key or the message!");
+        if (!messsage_file)
+            throw std::runtime_error("Could not read the message!");
 
         // Check and sign
-        check_message_exponent_and_modulus(
-                m, d1_client, n, RSA_PARTIAL_MODULUS_BITS);
-        Bignum y = Bignum::mod_exp(m, d1_client, n);
+        const Bignum y = compute_signature_share(keys, m);
 
         // Save the signature
-        std::ofstream client_sig(CLIENT_SIG_SHARE_FILE);
+        std::ofstream client_sig(CLIENT_SIG_SHARE_FILE, std::ios::binary);
         if (!client_sig)
             throw std::runtime_error("Could not save the signature!");
 
-        client_sig << m << '\n' << y << '\n';
+        write_bignums(client_sig, {m, y}, format);
 
         if (!client_sig)
             throw std::runtime_error("Could not save the signature!");
@@ -70,7 +296,172 @@ class Client : public SMPC_demo
         std::cout << "\x1B[1;32mOK\x1B[0m\n";
     }
 
-private:
+    /**
+     * @brief Signs every message from the batch file with client share of
+     * the client private exponent and saves the message and signature share
+     * pairs to corresponding file.
+     *
+     * @param jobs number of worker threads, 0 means one per hardware thread
+     * @throws std::runtime_exception if an IO problem occurs or some Bignum
+     *     operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    void sign_batch(unsigned jobs) override
+    {
+        std::cout << "Signing batch... " << std::flush;
+
+        const Client_keys keys =
+                load_keys(key_file(CLIENT_KEYS_CLIENT_SHARE_FILE));
+
+        std::ifstream messages_file(MESSAGES_BATCH_FILE);
+        if (!messages_file)
+            throw std::runtime_error("Messages file is missing!");
+
+        const std::vector<Bignum> messages = read_all_bignums(messages_file);
+        std::vector<Bignum> shares(messages.size());
+
+        run_parallel(messages.size(), jobs, [&](std::size_t i) {
+            try {
+                shares[i] = compute_signature_share(keys, messages[i]);
+            } catch (const std::exception &e) {
+                throw std::runtime_error(
+                        "Message " + std::to_string(i + 1) + ": " + e.what());
+            }
+        });
+
+        std::vector<std::reference_wrapper<const Bignum>> output;
+        output.reserve(2 * messages.size());
+        for (std::size_t i = 0; i < messages.size(); i++) {
+            output.emplace_back(messages[i]);
+            output.emplace_back(shares[i]);
+        }
+
+        std::ofstream client_sig(CLIENT_SIG_SHARES_BATCH_FILE, std::ios::binary);
+        write_bignums(client_sig, output, format);
+
+        if (!client_sig)
+            throw std::runtime_error("Could not save the signatures!");
+
+        std::cout << "\x1B[1;32mOK\x1B[0m (" << messages.size()
+                  << " messages)\n";
+    }
+
+    /**
+     * @brief Takes keys out of the key pool daemon.
+     *
+     * @param daemon connection to the key pool daemon
+     * @return client keys
+     * @throws std::runtime_exception if an IO problem occurs, the daemon
+     *     failed or its keys have got another bit length than the selected
+     *     one
+     */
+    Client_key_shares take_pooled_keys(Unix_socket &daemon) const
+    {
+        daemon.write_line("KEY");
+
+        std::string reply;
+        if (daemon.read_line(reply, MAX_POOL_REPLY_LENGTH) !=
+                Line_status::COMPLETE)
+            throw std::runtime_error("Key pool did not send the keys!");
+
+        const std::string error = "ERROR ";
+        if (reply.compare(0, error.size(), error) == 0)
+            throw std::runtime_error("Key pool: " + reply.substr(error.size()));
+
+        Client_key_shares keys;
+        std::istringstream in(reply);
+        std::string rest;
+        const bool valid = in >> keys.d1_client >> keys.d1_server >> keys.n1 >>
+                        keys.p >> keys.q &&
+                !(in >> rest);
+        OPENSSL_cleanse(&reply[0], reply.size());
+
+        if (!valid)
+            throw std::runtime_error("Key pool sent malformed keys!");
+
+        if (keys.n1.num_bits() != modulus_bits)
+            throw std::runtime_error("Key pool generates " +
+                    std::to_string(keys.n1.num_bits()) + "-bit keys!");
+
+        return keys;
+    }
+
+    /**
+     * @brief Answers all key requests received on the connection.
+     *
+     * @param pool key pool
+     * @param connection connected client
+     */
+    static void handle_pool_connection(Key_pool &pool, Unix_socket connection)
+    {
+        std::string request;
+        Line_status status;
+
+        while ((status = connection.read_line(
+                        request, MAX_POOL_REQUEST_LENGTH)) ==
+                Line_status::COMPLETE) {
+            if (request != "KEY") {
+                connection.write_line("ERROR Malformed request");
+                continue;
+            }
+
+            std::string reply;
+            try {
+                const Client_key_shares keys = pool.pop();
+
+                std::ostringstream out;
+                out << keys.d1_client << ' ' << keys.d1_server << ' '
+                    << keys.n1 << ' ' << keys.p << ' ' << keys.q;
+                reply = out.str();
+            } catch (const std::exception &e) {
+                reply = std::string("ERROR ") + e.what();
+            }
+
+            connection.write_line(reply);
+            OPENSSL_cleanse(&reply[0], reply.size());
+        }
+
+        if (status == Line_status::TOO_LONG) {
+            connection.write_line("ERROR Request too long");
+            connection.discard_input(MAX_DISCARDED_INPUT);
+        }
+    }
+
+    /**
+     * @brief Reads and returns the client share of client keys.
+     *
+     * @param file client key file
+     * @return client keys
+     * @throws std::runtime_exception if an IO problem occurs, the CRT
+     *     parameters do not match the modulus or some Bignum operation
+     *     failed
+     * @throws std::out_of_range if the modulus bit length is not supported
+     */
+    static Client_keys load_keys(const std::string &file)
+    {
+        std::ifstream client_keys(file, std::ios::binary);
+        if (!client_keys)
+            throw std::runtime_error("Client key has not been generated!");
+
+        // d1_client, n [, p, q, d_p, d_q, q_inv]
+        std::vector<Bignum> keys = read_all_bignums(client_keys);
+        if (keys.size() != 2 && keys.size() != 7)
+            throw std::runtime_error("Could not read the client key!");
+
+        std::unique_ptr<const Rsa_crt> crt_d1;
+        if (keys.size() == 7) {
+            if (keys[2] * keys[3] != keys[1])
+                throw std::runtime_error(
+                        "Client CRT parameters do not match the modulus!");
+
+            crt_d1 = std::make_unique<const Rsa_crt>(std::move(keys[2]),
+                    std::move(keys[3]), std::move(keys[4]), std::move(keys[5]),
+                    std::move(keys[6]));
+        }
+
+        return {std::move(keys[0]), std::move(keys[1]), std::move(crt_d1)};
+    }
+
     /**
      * @brief Saves generated keys to corresponding files, one for the client
      * itself and the other one for the server.
@@ -78,29 +469,65 @@ private:
      * @param d1_client - client share of the client private exponent (d'_1)
      * @param d1_server - server share of the client private exponent (d''_1)
      * @param n1 - client modulus
+     * @param p - first prime of the client modulus
+     * @param q - second prime of the client modulus
      * @throws std::runtime_exception if an IO problem occurs
      * @throws std::out_of_range if the client modulus bit length test fails
      */
-    void save_keys(
-            const Bignum &d1_client, const Bignum &d1_server, const Bignum &n1)
+    void save_keys(const Bignum &d1_client, const Bignum &d1_server,
+            const Bignum &n1, const Bignum &p, const Bignum &q)
     {
         std::cout << "Storing keys... " << std::flush;
 
-        check_num_bits(n1, RSA_PARTIAL_MODULUS_BITS);
+        write_keys(d1_client, d1_server, n1, p, q,
+                key_file(CLIENT_KEYS_CLIENT_SHARE_FILE),
+                key_file(CLIENT_KEYS_SERVER_SHARE_FILE));
+
+        std::cout << "\x1B[1;32mOK\x1B[0m\n";
+    }
+
+    /**
+     * @brief Writes the client keys to the given files. The primes are
+     * written to the client file only in the CRT mode and never to the
+     * server file.
+     *
+     * @param d1_client - client share of the client private exponent (d'_1)
+     * @param d1_server - server share of the client private exponent (d''_1)
+     * @param n1 - client modulus
+     * @param p - first prime of the client modulus
+     * @param q - second prime of the client modulus
+     * @param client_file - file of the client share
+     * @param server_file - file of the server share
+     * @throws std::runtime_exception if an IO problem occurs
+     * @throws std::out_of_range if the client modulus bit length test fails
+     */
+    void write_keys(const Bignum &d1_client, const Bignum &d1_server,
+            const Bignum &n1, const Bignum &p, const Bignum &q,
+            const std::string &client_file, const std::string &server_file)
+    {
+        get_partial_modulus_bits(n1);
 
-        std::ofstream client(CLIENT_KEYS_CLIENT_SHARE_FILE),
-                server(CLIENT_KEYS_SERVER_SHARE_FILE);
+        std::ofstream client(client_file, std::ios::binary),
+                server(server_file, std::ios::binary);
         if (!client || !server)
             throw std::runtime_error("Could not save the keys!");
 
         // exponent e is hardcoded and public, no need to send it out
-        client << d1_client << '\n' << n1 << '\n';
-        server << d1_server << '\n' << n1 << '\n';
+        if (crt) {
+            const Rsa_crt crt_d1 = Rsa_crt::from_primes(p, q, d1_client);
+            write_bignums(client,
+                    {d1_client, n1, crt_d1.get_p(), crt_d1.get_q(),
+                            crt_d1.get_d_p(), crt_d1.get_d_q(),
+                            crt_d1.get_q_inv()},
+                    format);
+        } else {
+            write_bignums(client, {d1_client, n1}, format);
+        }
+
+        write_bignums(server, {d1_server, n1}, format);
 
         if (!client || !server)
             throw std::runtime_error("Could not save the keys!");
-
-        std::cout << "\x1B[1;32mOK\x1B[0m\n";
     }
 };
 
@@ -1,5 +1,16 @@
 #include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <exception>
 #include <fstream>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 /****************************
  * SMPC_demo implementation *
@@ -9,71 +20,149 @@ void SMPC_demo::verify_final_signature()
 {
     std::cout << "Verifying signature... " << std::flush;
 
-    std::ifstream signature_file(FINAL_SIG_FILE), public_key(PUBLIC_KEY_FILE);
-    if (!signature_file || !public_key)
+    std::ifstream signature_file(FINAL_SIG_FILE, std::ios::binary),
+            public_key_file(key_file(PUBLIC_KEY_FILE), std::ios::binary);
+    if (!signature_file || !public_key_file)
         throw std::runtime_error("Signature or public key file is missing. Did "
                                  "you run the server?");
 
-    Bignum message, signature, n;
-    signature_file >> message >> signature;
-
-    // public exponent is hardcoded, we can skip it
-    public_key >> n >> n;
+    const auto final_signature = read_all_bignums(signature_file);
+    const auto public_key = read_all_bignums(public_key_file);
 
-    if (!signature_file || !public_key)
+    if (final_signature.size() != 2 || public_key.size() != 2)
         throw std::runtime_error("Could not read signature or public key.");
 
+    // public exponent is hardcoded, we can skip it
+    const Bignum &message = final_signature[0];
+    const Bignum &signature = final_signature[1];
+    const Bignum &n = public_key[1];
+
     check_message_exponent_and_modulus(
-            message, RSA_PUBLIC_EXP, n, RSA_PARTIAL_MODULUS_BITS * 2);
-    std::cout << (Bignum::mod_exp(signature, RSA_PUBLIC_EXP, n) == message
+            message, RSA_PUBLIC_EXP, n, get_partial_modulus_bits(n, 2) * 2);
+
+    const Verifier verifier{n};
+    std::cout << (verifier.verify(message, signature)
                           ? "\x1B[1;32mOK\x1B[0m\n"
                           : "\x1B[1;31mNOK\x1B[0m\n");
 }
 
+const std::size_t SMPC_demo::VERIFY_CHUNK_SIZE;
+const std::size_t SMPC_demo::REPORTED_INVALID_COUNT;
+
+void SMPC_demo::verify_batch(unsigned jobs)
+{
+    std::cout << "Verifying batch... " << std::flush;
+
+    std::ifstream signatures_file(FINAL_SIGS_BATCH_FILE, std::ios::binary),
+            public_key_file(key_file(PUBLIC_KEY_FILE), std::ios::binary);
+    if (!signatures_file || !public_key_file)
+        throw std::runtime_error("Batch signature or public key file is "
+                                 "missing. Did you run the server?");
+
+    const auto public_key = read_all_bignums(public_key_file);
+    if (public_key.size() != 2)
+        throw std::runtime_error("Could not read the public key.");
+
+    get_partial_modulus_bits(public_key[1], 2);
+    const Verifier verifier{public_key[1]};
+
+    Bignum_reader reader{signatures_file};
+    std::vector<Bignum> chunk;
+    std::vector<std::size_t> reported_invalid;
+    std::size_t total = 0, invalid = 0;
+
+    // message and signature pairs
+    while (reader.read(chunk, 2 * VERIFY_CHUNK_SIZE) != 0) {
+        for (std::size_t i : verifier.verify_batch(chunk, jobs)) {
+            if (reported_invalid.size() < REPORTED_INVALID_COUNT)
+                reported_invalid.push_back(total + i + 1);
+            invalid++;
+        }
+
+        total += chunk.size() / 2;
+        chunk.clear();
+    }
+
+    std::cout << (invalid == 0 ? "\x1B[1;32mOK\x1B[0m\n"
+                               : "\x1B[1;31mNOK\x1B[0m\n")
+              << "Verified: " << total << ", valid: " << total - invalid
+              << ", invalid: " << invalid << '\n';
+
+    if (invalid == 0)
+        return;
+
+    std::cout << "Invalid signatures of messages:";
+    for (std::size_t i : reported_invalid)
+        std::cout << ' ' << i;
+    std::cout << (invalid > reported_invalid.size() ? " ...\n" : "\n");
+}
+
+std::string SMPC_demo::key_file(const std::string &file) const
+{
+    return client_id == 0 ? file : indexed_file(file, client_id);
+}
+
 /*************************************
  * RSA_keys_generator implementation *
  ************************************/
 
+const unsigned RSA_keys_generator::TEST_COUNT;
+
 void RSA_keys_generator::generate_RSA_keys()
 {
-    if (!is_test)
+    if (verbose)
         std::cout << "Generating keys... " << std::flush;
 
-    const auto primes =
-            Rsa(RSA_PUBLIC_EXP, RSA_PARTIAL_MODULUS_BITS * 2, RSA_PRIME_COUNT)
-                    .getPrimes();
-    const Bignum &p = primes.first;
-    const Bignum &q = primes.second;
+    // primes are already coprime with e and their product has got the
+    // needed bit length
+    auto primes = Rsa(RSA_PUBLIC_EXP, bits).getPrimes();
+    p = std::move(primes.first);
+    q = std::move(primes.second);
 
-    const auto bits = RSA_PARTIAL_MODULUS_BITS / 2;
-    check_num_bits(p, bits);
-    check_num_bits(q, bits);
+    generate_keys_from_primes();
 
-    Bignum p_phi = p - 1;
-    Bignum q_phi = q - 1;
+    if (verbose)
+        std::cout << "\x1B[1;32mOK\x1B[0m\n";
+}
 
-    e_coprimality_test(p_phi);
-    e_coprimality_test(q_phi);
+void RSA_keys_generator::generate_RSA_keys(const Bignum &coprime_modulus)
+{
+    if (verbose)
+        std::cout << "Generating keys... " << std::flush;
 
-    generate_private_key(p_phi, q_phi);
-    generate_modulus(p, q);
+    bits = get_partial_modulus_bits(coprime_modulus);
 
-    if (!is_test)
+    // coprime_modulus * n >= 2^(2 * bits - 1), i.e.
+    // n >= ceil(2^(2 * bits - 1) / coprime_modulus)
+    Bignum min_modulus;
+    min_modulus.set_bit(bits * 2 - 1);
+    min_modulus = Bignum::div(min_modulus - 1, coprime_modulus) + 1;
+
+    do {
+        auto primes = Rsa(RSA_PUBLIC_EXP, bits, min_modulus).getPrimes();
+        p = std::move(primes.first);
+        q = std::move(primes.second);
+    } while (!Bignum::gcd(p * q, coprime_modulus).is_one());
+
+    generate_keys_from_primes();
+
+    if (verbose)
         std::cout << "\x1B[1;32mOK\x1B[0m\n";
 }
 
-void RSA_keys_generator::e_coprimality_test(const Bignum &num)
+void RSA_keys_generator::generate_keys_from_primes()
 {
-    Bignum gcdResult = Bignum::gcd(num, RSA_PUBLIC_EXP);
+    Bignum p_phi = p - 1;
+    Bignum q_phi = q - 1;
 
-    if (!gcdResult.is_one())
-        throw std::runtime_error("The generated prime is not coprime with e.");
+    generate_private_key(p_phi, q_phi);
+    generate_modulus(p, q);
 }
 
 void RSA_keys_generator::generate_modulus(const Bignum &p, const Bignum &q)
 {
     n = p * q;
-    check_num_bits(n, RSA_PARTIAL_MODULUS_BITS);
+    check_num_bits(n, bits);
 }
 
 void RSA_keys_generator::generate_private_key(
@@ -85,7 +174,7 @@ void RSA_keys_generator::generate_private_key(
     if (is_test || is_server)
         return;
 
-    d1_client.set_random_value(RSA_PARTIAL_MODULUS_BITS);
+    d1_client.set_random_value(bits);
     d1_client.mod(phi_n);
 
     d1_server = Bignum::mod_sub(d2, d1_client, phi_n);
@@ -112,35 +201,179 @@ const Bignum &RSA_keys_generator::get_n() const
     return n;
 }
 
-void RSA_keys_generator::run_test()
+const Bignum &RSA_keys_generator::get_p() const
+{
+    return p;
+}
+
+const Bignum &RSA_keys_generator::get_q() const
+{
+    return q;
+}
+
+void RSA_keys_generator::set_verbose(bool enabled)
 {
-    is_test = true;
+    verbose = enabled;
+}
+
+void RSA_keys_generator::set_modulus_bits(int bits)
+{
+    if (!is_supported_modulus_bits(bits))
+        throw std::invalid_argument("Unsupported modulus bit length: " +
+                                    std::to_string(bits));
+
+    this->bits = bits;
+}
+
+void RSA_keys_generator::run_test(unsigned jobs)
+{
+    using clock = std::chrono::steady_clock;
+
     std::cout << "Testing...\n";
-    bool failed{false};
+    Prime_engine &engine = Prime_engine::get_default();
+    engine.reset_statistics();
+
+    std::mutex output_mutex;
+    std::atomic<unsigned> failed_count{0};
+    std::vector<clock::duration> durations(TEST_COUNT);
 
-    Bignum original{
+    const Bignum original{
             "48654681406840615136541141350146514654630436044654674266181",
             false};
 
-    for (std::size_t i = 1; i <= TEST_COUNT; i++) {
-        std::cout << "TEST " << i << ": " << std::flush;
-        generate_RSA_keys();
+    const auto start = clock::now();
+    run_parallel(TEST_COUNT, jobs, [&](std::size_t i) {
+        const auto test_start = clock::now();
 
+        RSA_keys_generator generator;
+        generator.is_test = true;
+        generator.verbose = false;
+        generator.generate_RSA_keys();
+
+        const Bignum &n = generator.get_n();
         Bignum ciphertext = Bignum::mod_exp(original, RSA_PUBLIC_EXP, n);
-        Bignum plaintext = Bignum::mod_exp(ciphertext, d2, n);
+        Bignum plaintext = Bignum::mod_exp(ciphertext, generator.get_d2(), n);
+        const bool failed = plaintext != original;
+
+        durations[i] = clock::now() - test_start;
+        if (failed)
+            failed_count++;
 
-        if (plaintext != original) {
-            failed = true;
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << "TEST " << i + 1 << ": ";
+        if (failed) {
             std::cerr << "\x1B[1;31mNOK\x1B[0m\n";
-            continue;
+            return;
         }
 
         std::cout << "\x1B[1;32mOK\x1B[0m\n";
-    }
+    });
+    const auto wall = clock::now() - start;
+
+    const auto to_ms = [](clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    };
+
+    clock::duration total{};
+    for (const auto &d : durations)
+        total += d;
+
+    const auto minmax = std::minmax_element(durations.begin(), durations.end());
+
+    std::cout << "Passed: " << TEST_COUNT - failed_count << '/' << TEST_COUNT
+              << ", failed: " << failed_count << '\n'
+              << std::fixed << std::setprecision(2)
+              << "Time: " << to_ms(wall) << " ms wall, per test "
+              << to_ms(*minmax.first) << " min / "
+              << to_ms(total / TEST_COUNT) << " mean / "
+              << to_ms(*minmax.second) << " max ms\n"
+              << std::defaultfloat;
+
+    const Prime_statistics stats = engine.get_statistics();
+    const auto per_prime = [&stats](std::uint64_t count) {
+        return static_cast<double>(count) /
+                static_cast<double>(std::max<std::uint64_t>(stats.primes, 1));
+    };
+
+    std::cout << "Primes: " << stats.primes << " by the " << engine.get_name()
+              << " engine, per prime " << std::fixed << std::setprecision(1)
+              << per_prime(stats.candidates) << " candidates / "
+              << per_prime(stats.primality_tests) << " primality tests, "
+              << "sieved out " << 100 * stats.sieve_hit_rate() << " %\n"
+              << std::defaultfloat;
 
     std::cout << "Result: "
-              << (failed ? "\x1B[1;31mNOK\x1B[0m\n" : "\x1B[1;32mOK\x1B[0m\n");
-    is_test = false;
+              << (failed_count != 0 ? "\x1B[1;31mNOK\x1B[0m\n"
+                                    : "\x1B[1;32mOK\x1B[0m\n");
+}
+
+/***************************
+ * Verifier implementation *
+ **************************/
+
+Verifier::Verifier(const Bignum &n) : mont_n(n) {}
+
+const Bignum &Verifier::get_modulus() const
+{
+    return mont_n.get_modulus();
+}
+
+bool Verifier::verify(const Bignum &message, const Bignum &signature,
+        Bignum_CTX &ctx) const
+{
+    TIME_STAGE(VERIFY_EXP);
+
+    if (signature.is_negative() || signature >= get_modulus())
+        return false;
+
+    Bignum_scope scope(ctx);
+    Bignum &m_test = scope.get();
+    Bignum::mod_exp_word_into(m_test, signature, RSA_PUBLIC_EXP, mont_n, ctx);
+
+    return m_test == message;
+}
+
+std::vector<std::size_t> Verifier::verify_batch(
+        const std::vector<Bignum> &pairs, unsigned jobs) const
+{
+    if (pairs.size() % 2 != 0)
+        throw std::invalid_argument("Signature is missing for the last "
+                                    "message.");
+
+    // char instead of bool, std::vector<bool> cannot be written concurrently
+    std::vector<char> valid(pairs.size() / 2);
+
+    // groups of several vector passes amortise the per-call setup
+    const std::size_t group = 4 * Mod_exp_batch::LANES;
+    const std::size_t groups = (valid.size() + group - 1) / group;
+
+    run_parallel(groups, jobs, [&](std::size_t g) {
+        TIME_STAGE(VERIFY_EXP);
+
+        const std::size_t first = g * group;
+        const std::size_t last = std::min(first + group, valid.size());
+
+        // signatures out of range are invalid, zero stands in for them
+        std::vector<Bignum> signatures, m_test;
+        for (std::size_t i = first; i < last; i++) {
+            const Bignum &s = pairs[2 * i + 1];
+            valid[i] = !s.is_negative() && s < get_modulus();
+            signatures.push_back(valid[i] ? s : Bignum());
+        }
+
+        const Bignum e{RSA_PUBLIC_EXP};
+        Mod_exp_batch::mod_exp(m_test, signatures, e, mont_n);
+
+        for (std::size_t i = first; i < last; i++)
+            valid[i] = valid[i] && m_test[i - first] == pairs[2 * i];
+    });
+
+    std::vector<std::size_t> invalid;
+    for (std::size_t i = 0; i < valid.size(); i++)
+        if (!valid[i])
+            invalid.push_back(i);
+
+    return invalid;
 }
 
 /********************
@@ -154,9 +387,34 @@ void check_num_bits(const Bignum &num, int bits)
                                 std::to_string(bits) + "-bit number!");
 }
 
+bool is_supported_modulus_bits(int bits)
+{
+    return bits == 1024 || bits == 1536 || bits == 2048 || bits == 3072;
+}
+
+int get_partial_modulus_bits(const Bignum &n, int parts)
+{
+    const int bits = n.num_bits();
+    if (bits % parts != 0 || !is_supported_modulus_bits(bits / parts))
+        throw std::out_of_range("Modulus has got an unsupported bit "
+                                "length (" + std::to_string(bits) + ")!");
+
+    return bits / parts;
+}
+
+int check_partial_modulus(const Bignum &n)
+{
+    const int bits = get_partial_modulus_bits(n);
+    if (!n.is_odd())
+        throw std::out_of_range("Modulus cannot be even!");
+
+    return bits;
+}
+
 void check_message_exponent_and_modulus(
         const Bignum &message, const Bignum &d, const Bignum &n, int bits)
 {
+    TIME_STAGE(BOUND_CHECK);
     check_num_bits(n, bits);
     if (message >= n)
         throw std::out_of_range("Message cannot be greater than or equal to "
@@ -168,6 +426,86 @@ void check_message_exponent_and_modulus(
                                 "equal to the partial modulus!");
 }
 
+void run_parallel(std::size_t count, unsigned jobs,
+        const std::function<void(std::size_t)> &task)
+{
+    if (jobs == 0)
+        jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (jobs == 1 || count <= 1) {
+        for (std::size_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> stop{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    const auto worker = [&]() {
+        for (std::size_t i = next++; i < count && !stop; i = next++) {
+            try {
+                task(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+                stop = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    const auto threads = std::min<std::size_t>(jobs, count);
+    workers.reserve(threads);
+    for (std::size_t i = 0; i < threads; i++)
+        workers.emplace_back(worker);
+
+    for (auto &thread : workers)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+std::string indexed_file(const std::string &file, std::size_t index)
+{
+    const std::size_t dot = file.rfind('.');
+    const std::string extension =
+            dot == std::string::npos ? "" : file.substr(dot);
+
+    return file.substr(0, dot) + '.' + std::to_string(index) + extension;
+}
+
+bool parse_number(const std::string &text, unsigned long long max,
+        unsigned long long &value)
+{
+    if (text.empty() || !std::all_of(text.begin(), text.end(), [](char c) {
+            return std::isdigit(static_cast<unsigned char>(c)) != 0;
+        }))
+        return false;
+
+    try {
+        value = std::stoull(text);
+    } catch (const std::out_of_range &) {
+        return false;
+    }
+
+    return value <= max;
+}
+
+bool parse_client_id(const std::string &text, std::size_t &id)
+{
+    unsigned long long value;
+    if (!parse_number(text, std::numeric_limits<std::size_t>::max(), value) ||
+            value == 0)
+        return false;
+
+    id = static_cast<std::size_t>(value);
+    return true;
+}
+
 bool regenerate_keys()
 {
     std::string answer;
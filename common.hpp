@@ -1,9 +1,15 @@
 #ifndef COMMON_HPP
 #define COMMON_HPP
 
+#include "bignum_file.hpp"
 #include "bignum_wrapper.hpp"
+#include "instrumentation.hpp"
+#include "mod_exp_batch.hpp"
 #include "rsa_wrapper.hpp"
 
+#include <functional>
+#include <vector>
+
 #define CLIENT_KEYS_CLIENT_SHARE_FILE "client_card.key"
 #define CLIENT_KEYS_SERVER_SHARE_FILE "for_server.key"
 #define SERVER_KEYS_FILE "server.key"
@@ -13,15 +19,26 @@
 #define CLIENT_SIG_SHARE_FILE "client.sig"
 #define FINAL_SIG_FILE "final.sig"
 
-#define RSA_PRIME_COUNT 4u
+#define MESSAGES_BATCH_FILE "messages.txt"
+#define CLIENT_SIG_SHARES_BATCH_FILE "client_batch.sig"
+#define FINAL_SIGS_BATCH_FILE "final_batch.sig"
+
+#define SERVER_SOCKET_FILE "server.sock"
+#define KEY_POOL_SOCKET_FILE "key_pool.sock"
+
 #define RSA_PUBLIC_EXP 65537u
-#define RSA_PARTIAL_MODULUS_BITS 2048u
+#define RSA_DEFAULT_PARTIAL_MODULUS_BITS 2048u
+// the largest bit length accepted by is_supported_modulus_bits
+#define RSA_MAX_PARTIAL_MODULUS_BITS 3072u
 
 /**
  * @brief Abstract class representing a party (e.g. client) in this protocol.
  */
 class SMPC_demo
 {
+    static const std::size_t VERIFY_CHUNK_SIZE{4096};
+    static const std::size_t REPORTED_INVALID_COUNT{10};
+
 public:
     /**
      * @brief Generates the RSA keys of a given party.
@@ -33,6 +50,14 @@ public:
      */
     virtual void sign_message() = 0;
 
+    /**
+     * @brief Performs a computation of signature shares of a given party
+     * for a whole batch of messages, splitting the work across threads.
+     *
+     * @param jobs number of worker threads, 0 means one per hardware thread
+     */
+    virtual void sign_batch(unsigned jobs) = 0;
+
     /**
      * @brief Verifies the given final signature.
      *
@@ -42,7 +67,54 @@ public:
      */
     void verify_final_signature();
 
+    /**
+     * @brief Verifies every message and signature pair of the final batch
+     * file. The file is streamed in chunks, every chunk is verified in
+     * parallel. Prints the number of valid and invalid signatures.
+     *
+     * @param jobs number of worker threads, 0 means one per hardware thread
+     * @throws std::runtime_exception if an IO problem occurs or some Bignum
+     *     operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    void verify_batch(unsigned jobs);
+
+    /**
+     * @brief Sets the format of written key and signature files. Read files
+     * are accepted in any format.
+     *
+     * @param file_format format of written files
+     */
+    void set_file_format(File_format file_format)
+    {
+        format = file_format;
+    }
+
+    /**
+     * @brief Selects the client whose key files are used, i.e. the indexed
+     * key files of the given card, e.g. client_card.3.key or server.3.key.
+     * The default key files are used for 0.
+     *
+     * @param id client ID
+     */
+    void set_client_id(std::size_t id)
+    {
+        client_id = id;
+    }
+
     virtual ~SMPC_demo() = default;
+
+protected:
+    File_format format{File_format::HEX};
+    std::size_t client_id{0};
+
+    /**
+     * @brief Returns the key file of the selected client.
+     *
+     * @param file default key file
+     * @return key file
+     */
+    std::string key_file(const std::string &file) const;
 };
 
 /**
@@ -73,6 +145,20 @@ public:
      */
     void generate_RSA_keys();
 
+    /**
+     * @brief Generates needed RSA keys like generate_RSA_keys, but the
+     * modulus is coprime with the given one and their product has got
+     * exactly twice the bit length of the given modulus, which overrides
+     * the set modulus bit length. Unsuitable moduli are regenerated
+     * internally.
+     *
+     * @param coprime_modulus partial modulus of the other party
+     * @throws std::runtime_exception if some Bignum operation failed
+     * @throws std::out_of_range if the given modulus has got an unsupported
+     *     bit length
+     */
+    void generate_RSA_keys(const Bignum &coprime_modulus);
+
     /**
      * @brief Returns the client share of the client private
      * exponent. (d'_1)
@@ -103,26 +189,111 @@ public:
      */
     const Bignum &get_n() const;
 
+    /**
+     * @brief Returns the first prime factor of the modulus.
+     *
+     * @return first prime factor
+     */
+    const Bignum &get_p() const;
+
+    /**
+     * @brief Returns the second prime factor of the modulus.
+     *
+     * @return second prime factor
+     */
+    const Bignum &get_q() const;
+
+    /**
+     * @brief Enables or disables progress messages on the standard output.
+     *
+     * @param enabled whether progress should be printed
+     */
+    void set_verbose(bool enabled);
+
+    /**
+     * @brief Sets the bit length of generated moduli, the default is
+     * RSA_DEFAULT_PARTIAL_MODULUS_BITS.
+     *
+     * @param bits partial modulus bit length
+     * @throws std::invalid_argument if the bit length is not supported
+     */
+    void set_modulus_bits(int bits);
+
     /**
      * @brief Runs a self-test. Test count is set in the TEST_COUNT
      * attribute.
+     *
+     * @param jobs number of worker threads, 0 means one per hardware thread
+     * @throws std::runtime_exception if some Bignum operation failed
      */
-    void run_test();
+    void run_test(unsigned jobs = 1);
 
 private:
     Bignum d1_client;
     Bignum d1_server;
     Bignum d2;
     Bignum n;
+    Bignum p;
+    Bignum q;
 
     bool is_server{false};
     bool is_test{false};
+    bool verbose{true};
+    int bits{RSA_DEFAULT_PARTIAL_MODULUS_BITS};
 
-    void e_coprimality_test(const Bignum &num);
+    void generate_keys_from_primes();
     void generate_modulus(const Bignum &p, const Bignum &q);
     void generate_private_key(const Bignum &phi_p, const Bignum &phi_q);
 };
 
+/**
+ * @brief Signature verifier bound to a public modulus and the fixed public
+ * exponent RSA_PUBLIC_EXP. The Montgomery context is built once, every
+ * verification then costs 16 Montgomery squarings and one multiplication.
+ * The verifier is only read after construction, so it may be shared by
+ * several threads.
+ */
+class Verifier
+{
+    Bignum_mont_CTX mont_n;
+
+public:
+    /**
+     * @param n public modulus
+     * @throws std::runtime_exception if some Bignum operation failed
+     */
+    explicit Verifier(const Bignum &n);
+
+    const Bignum &get_modulus() const;
+
+    /**
+     * @brief Verifies the signature of the message.
+     *
+     * @param message message
+     * @param signature signature
+     * @param ctx context used for all Bignum operations
+     * @return true if the signature is valid, false otherwise
+     * @throws std::runtime_exception if some Bignum operation failed
+     */
+    bool verify(const Bignum &message, const Bignum &signature,
+            Bignum_CTX &ctx = Bignum::ctx) const;
+
+    /**
+     * @brief Verifies many signatures in parallel, every thread verifies
+     * groups of signatures by the batched exponentiation.
+     *
+     * @param pairs message and signature pairs, i.e. m_1 s_1 m_2 s_2 ...
+     * @param jobs number of worker threads, 0 means one per hardware thread
+     * @return indices of the pairs with an invalid signature in ascending
+     *     order
+     * @throws std::invalid_argument if the signature of the last message is
+     *     missing
+     * @throws std::runtime_exception if some Bignum operation failed
+     */
+    std::vector<std::size_t> verify_batch(
+            const std::vector<Bignum> &pairs, unsigned jobs = 1) const;
+};
+
 /**
  * @brief Checks that given Bignum has got the needed
  * bit length.
@@ -133,6 +304,38 @@ private:
  */
 void check_num_bits(const Bignum &num, int bits);
 
+/**
+ * @brief Checks that the partial modulus bit length is supported, i.e. one
+ * of 1024, 1536, 2048 and 3072.
+ *
+ * @param bits partial modulus bit length
+ * @return true if the bit length is supported, false otherwise
+ */
+bool is_supported_modulus_bits(int bits);
+
+/**
+ * @brief Returns the partial modulus bit length of the given modulus, so
+ * that key files carry the key size in their moduli.
+ *
+ * @param n modulus
+ * @param parts number of partial moduli multiplied in n, i.e. 1 for n1 and
+ *     n2 and 2 for the public modulus
+ * @return partial modulus bit length
+ * @throws std::out_of_range if the bit length is not supported
+ */
+int get_partial_modulus_bits(const Bignum &n, int parts = 1);
+
+/**
+ * @brief Checks that the partial modulus of loaded keys has got a supported
+ * bit length and is odd, i.e. that a Montgomery context can be built for
+ * it.
+ *
+ * @param n partial modulus
+ * @return partial modulus bit length
+ * @throws std::out_of_range if the check fails
+ */
+int check_partial_modulus(const Bignum &n);
+
 /**
  * @brief Checks that the message and the modulus meet
  * given conditions. Modulus has got the needed bit length
@@ -147,6 +350,53 @@ void check_num_bits(const Bignum &num, int bits);
 void check_message_exponent_and_modulus(
         const Bignum &message, const Bignum &d1, const Bignum &n, int bits);
 
+/**
+ * @brief Calls the task for every index in [0, count) using the given
+ * number of worker threads. Every thread uses its own Bignum context.
+ * Remaining indices are skipped once a task throws.
+ *
+ * @param count number of indices
+ * @param jobs number of worker threads, 0 means one per hardware thread
+ * @param task task to be called with every index
+ * @throws the first exception thrown by the task
+ */
+void run_parallel(std::size_t count, unsigned jobs,
+        const std::function<void(std::size_t)> &task);
+
+/**
+ * @brief Inserts the index before the file extension, e.g.
+ * client_card.key becomes client_card.3.key.
+ *
+ * @param file file name
+ * @param index index
+ * @return indexed file name
+ */
+std::string indexed_file(const std::string &file, std::size_t index);
+
+/**
+ * @brief Parses a decimal number not greater than max. Unlike std::stoul,
+ * signs and whitespace are rejected, so "-1" does not wrap around.
+ *
+ * @param text number
+ * @param max largest accepted value
+ * @param value parsed number
+ * @return true if the text is a valid number, false otherwise
+ */
+bool parse_number(const std::string &text, unsigned long long max,
+        unsigned long long &value);
+
+/**
+ * @brief Parses a client ID, i.e. a positive decimal number fitting into
+ * std::size_t. Zero is rejected, as it stands for the default key files,
+ * and so are signs and whitespace. Used by the command line as well as by
+ * the signing daemon.
+ *
+ * @param text client ID
+ * @param id parsed client ID
+ * @return true if the ID is valid, false otherwise
+ */
+bool parse_client_id(const std::string &text, std::size_t &id);
+
 /**
  * @brief Asks the user whether he wishes to regenerate the keys.
  *
@@ -0,0 +1,88 @@
+#include "instrumentation.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+
+namespace {
+
+struct Stage_counters
+{
+    std::atomic<std::uint64_t> count{0};
+    std::atomic<std::uint64_t> total_ns{0};
+    std::atomic<std::uint64_t> max_ns{0};
+};
+
+const std::size_t STAGE_COUNT = static_cast<std::size_t>(Metric_stage::COUNT);
+
+const std::array<const char *, STAGE_COUNT> STAGE_NAMES = {"file_load",
+        "parse", "bound_check", "client_exp", "server_finish_exp",
+        "fraud_check", "server_exp", "recombination", "verify_exp", "output"};
+
+std::array<Stage_counters, STAGE_COUNT> counters;
+
+void write_json(std::ostream &out)
+{
+    out << "{\"stages\": {";
+
+    for (std::size_t i = 0; i < STAGE_COUNT; i++)
+        out << (i == 0 ? "" : ", ") << '"' << STAGE_NAMES[i]
+            << "\": {\"count\": " << counters[i].count
+            << ", \"total_ns\": " << counters[i].total_ns
+            << ", \"max_ns\": " << counters[i].max_ns << '}';
+
+    out << "}}\n";
+}
+
+void write_prometheus(std::ostream &out)
+{
+    const auto write_metric = [&out](const char *name, const char *type,
+                                      const char *help, auto value) {
+        out << "# HELP " << name << ' ' << help << '\n'
+            << "# TYPE " << name << ' ' << type << '\n';
+
+        for (std::size_t i = 0; i < STAGE_COUNT; i++)
+            out << name << "{stage=\"" << STAGE_NAMES[i] << "\"} "
+                << value(counters[i]) << '\n';
+    };
+
+    const auto to_seconds = [](std::uint64_t ns) {
+        return static_cast<double>(ns) / 1e9;
+    };
+
+    out << std::setprecision(9);
+    write_metric("smpc_stage_runs_total", "counter",
+            "Number of runs of the stage.",
+            [](const Stage_counters &c) { return c.count.load(); });
+    write_metric("smpc_stage_seconds_total", "counter",
+            "Total time spent in the stage.",
+            [&](const Stage_counters &c) { return to_seconds(c.total_ns); });
+    write_metric("smpc_stage_max_seconds", "gauge",
+            "Longest single run of the stage.",
+            [&](const Stage_counters &c) { return to_seconds(c.max_ns); });
+}
+
+}    // namespace
+
+void record_stage_time(
+        Metric_stage stage, std::chrono::steady_clock::duration time)
+{
+    Stage_counters &c = counters[static_cast<std::size_t>(stage)];
+    const auto ns = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+
+    c.count++;
+    c.total_ns += ns;
+
+    std::uint64_t max = c.max_ns;
+    while (ns > max && !c.max_ns.compare_exchange_weak(max, ns)) {}
+}
+
+void write_metrics(std::ostream &out, Metrics_format format)
+{
+    if (format == Metrics_format::JSON)
+        write_json(out);
+    else
+        write_prometheus(out);
+}
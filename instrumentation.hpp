@@ -0,0 +1,93 @@
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#include <chrono>
+#include <iostream>
+
+/**
+ * Per-stage timers of the signing path. The timers are compiled in only
+ * when SMPC_INSTRUMENTATION is defined (CMake option of the same name),
+ * otherwise TIME_STAGE expands to nothing.
+ */
+
+/**
+ * @brief Instrumented stages of the signing path.
+ */
+enum class Metric_stage {
+    FILE_LOAD,
+    PARSE,
+    BOUND_CHECK,
+    CLIENT_EXP,
+    SERVER_FINISH_EXP,
+    FRAUD_CHECK,
+    SERVER_EXP,
+    RECOMBINATION,
+    VERIFY_EXP,
+    OUTPUT,
+    COUNT
+};
+
+/**
+ * @brief Output format of the recorded metrics.
+ */
+enum class Metrics_format { JSON, PROMETHEUS };
+
+#ifdef SMPC_INSTRUMENTATION
+const bool INSTRUMENTATION_ENABLED = true;
+#else
+const bool INSTRUMENTATION_ENABLED = false;
+#endif
+
+/**
+ * @brief Adds a single run of the stage to its counters. Thread safe.
+ *
+ * @param stage measured stage
+ * @param time time spent in the stage
+ */
+void record_stage_time(
+        Metric_stage stage, std::chrono::steady_clock::duration time);
+
+/**
+ * @brief Writes the number of runs, total and maximal time of every stage.
+ *
+ * @param out output stream
+ * @param format output format
+ */
+void write_metrics(std::ostream &out, Metrics_format format);
+
+/**
+ * @brief Records the time from its construction to its destruction.
+ */
+class Stage_timer
+{
+    Metric_stage stage;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit Stage_timer(Metric_stage stage)
+        : stage(stage), start(std::chrono::steady_clock::now())
+    {}
+
+    Stage_timer(const Stage_timer &) = delete;
+    Stage_timer &operator=(const Stage_timer &) = delete;
+
+    ~Stage_timer()
+    {
+        record_stage_time(stage, std::chrono::steady_clock::now() - start);
+    }
+};
+
+#define STAGE_TIMER_NAME_IMPL(line) stage_timer_##line
+#define STAGE_TIMER_NAME(line) STAGE_TIMER_NAME_IMPL(line)
+
+#ifdef SMPC_INSTRUMENTATION
+/**
+ * @brief Times the rest of the enclosing scope as the given stage.
+ */
+#define TIME_STAGE(stage) \
+    const Stage_timer STAGE_TIMER_NAME(__LINE__) { Metric_stage::stage }
+#else
+#define TIME_STAGE(stage) static_cast<void>(0)
+#endif
+
+#endif    // INSTRUMENTATION_HPP
@@ -0,0 +1,290 @@
+#ifndef KEY_POOL_HPP
+#define KEY_POOL_HPP
+
+#include "common.hpp"
+
+#include <openssl/crypto.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Freshly generated client keys, i.e. both shares of the client
+ * private exponent, the client modulus and its primes.
+ */
+struct Client_key_shares
+{
+    Bignum d1_client;
+    Bignum d1_server;
+    Bignum n1;
+    Bignum p;
+    Bignum q;
+};
+
+/**
+ * @brief Pool of pre-generated and validated client keys refilled by
+ * background threads, so that taking keys out of the pool does not wait
+ * for the prime search unless the pool has been drained.
+ *
+ * Pooled keys are stored as fixed-size big-endian numbers in slots of a
+ * single mapping locked in memory and excluded from core dumps. Its size
+ * is given by the depth and the modulus bit length, so only the pooled
+ * key material is locked. Slots are wiped when their keys are taken out
+ * and when the pool is destroyed. Temporaries of the key generation stay
+ * on the ordinary heap and are wiped when freed, as all Bignums are.
+ */
+class Key_pool
+{
+    // d1_client, d1_server, n1, p and q, all of them are below n1
+    static const std::size_t FIELDS{5};
+
+    const std::size_t depth;
+    const int bits;
+    const std::size_t field_size;
+
+    unsigned char *memory{nullptr};
+    std::size_t memory_size;
+    bool locked{false};
+
+    // indices of the slots holding keys, in the order of insertion
+    std::deque<std::size_t> keys;
+    std::vector<std::size_t> free_slots;
+    std::exception_ptr error;
+    bool stopping{false};
+
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::vector<std::thread> workers;
+
+public:
+    /**
+     * @brief Maps the slots of the pooled keys and starts the refill
+     * threads. Every thread generates keys until the pool holds depth keys,
+     * so the refill rate is given by the number of threads.
+     *
+     * @param depth maximal number of pooled keys
+     * @param jobs number of refill threads, 0 means one per hardware thread
+     * @param bits bit length of the client modulus
+     * @throws std::runtime_exception if the slots could not be mapped
+     * @throws std::system_error if a refill thread could not be started
+     */
+    Key_pool(std::size_t depth, unsigned jobs,
+            int bits = RSA_DEFAULT_PARTIAL_MODULUS_BITS)
+        : depth(std::max<std::size_t>(depth, 1)), bits(bits),
+          field_size((bits + 7) / 8),
+          memory_size(this->depth * FIELDS * field_size)
+    {
+        void *mapping = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("Failed to map the key pool memory!");
+
+        memory = static_cast<unsigned char *>(mapping);
+        locked = mlock(memory, memory_size) == 0;
+#ifdef MADV_DONTDUMP
+        madvise(memory, memory_size, MADV_DONTDUMP);
+#endif
+
+        for (std::size_t i = this->depth; i > 0; i--)
+            free_slots.push_back(i - 1);
+
+        if (jobs == 0)
+            jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+        try {
+            for (unsigned i = 0; i < jobs; i++)
+                workers.emplace_back(&Key_pool::refill, this);
+        } catch (...) {
+            // the destructor is not called for a partially constructed pool
+            stop();
+            unmap();
+            throw;
+        }
+    }
+
+    Key_pool(const Key_pool &) = delete;
+    Key_pool &operator=(const Key_pool &) = delete;
+
+    /**
+     * @brief Stops the refill threads. Waits for keys being generated at
+     * the moment, the pooled keys are wiped.
+     */
+    ~Key_pool()
+    {
+        stop();
+        unmap();
+    }
+
+    /**
+     * @brief Takes keys out of the pool, waits if the pool is empty.
+     *
+     * @return client keys
+     * @throws std::runtime_exception if the key generation failed
+     */
+    Client_key_shares pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]() { return !keys.empty() || error; });
+
+        if (keys.empty())
+            std::rethrow_exception(error);
+
+        const std::size_t slot = keys.front();
+        keys.pop_front();
+
+        Client_key_shares shares;
+        load(slot, shares);
+
+        free_slots.push_back(slot);
+        not_full.notify_one();
+        return shares;
+    }
+
+    /**
+     * @return true if the pooled keys are stored in locked memory
+     */
+    bool is_memory_locked() const
+    {
+        return locked;
+    }
+
+private:
+    /**
+     * @brief Stops and joins the started refill threads.
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        not_full.notify_all();
+        not_empty.notify_all();
+
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    /**
+     * @brief Wipes and unmaps the slots.
+     */
+    void unmap()
+    {
+        OPENSSL_cleanse(memory, memory_size);
+        if (locked)
+            munlock(memory, memory_size);
+
+        munmap(memory, memory_size);
+    }
+
+    void refill()
+    {
+        try {
+            while (true) {
+                Client_key_shares shares = generate(bits);
+
+                std::unique_lock<std::mutex> lock(mutex);
+                not_full.wait(lock, [this]() {
+                    return stopping || !free_slots.empty();
+                });
+
+                if (stopping)
+                    return;
+
+                const std::size_t slot = free_slots.back();
+                free_slots.pop_back();
+
+                store(slot, shares);
+                keys.push_back(slot);
+                not_empty.notify_one();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+
+            not_empty.notify_all();
+        }
+    }
+
+    /**
+     * @brief Generates client keys and checks that signing a random message
+     * with both exponent shares gives a valid signature.
+     */
+    static Client_key_shares generate(int bits)
+    {
+        RSA_keys_generator rsa;
+        rsa.set_verbose(false);
+        rsa.set_modulus_bits(bits);
+        rsa.generate_RSA_keys();
+
+        Client_key_shares shares{rsa.get_d1_client(), rsa.get_d1_server(),
+                rsa.get_n(), rsa.get_p(), rsa.get_q()};
+        const Bignum_mont_CTX mont_n{shares.n1};
+
+        Bignum m;
+        m.set_random_value(bits - 1);
+
+        Bignum s = Bignum::mod_exp(m, shares.d1_client, mont_n);
+        s.mod_mul_self(Bignum::mod_exp(m, shares.d1_server, mont_n), shares.n1);
+
+        if (Bignum::mod_exp_word(s, RSA_PUBLIC_EXP, mont_n) != m)
+            throw std::runtime_error("Generated client keys are invalid!");
+
+        return shares;
+    }
+
+    /**
+     * @return the given field of the given slot
+     */
+    unsigned char *field(std::size_t slot, std::size_t index)
+    {
+        return memory + (slot * FIELDS + index) * field_size;
+    }
+
+    /**
+     * @brief Copies the keys into the slot, the caller holds the mutex.
+     *
+     * @throws std::runtime_exception if a number does not fit into a field
+     */
+    void store(std::size_t slot, const Client_key_shares &shares)
+    {
+        const Bignum *numbers[FIELDS] = {&shares.d1_client,
+                &shares.d1_server, &shares.n1, &shares.p, &shares.q};
+
+        for (std::size_t i = 0; i < FIELDS; i++) {
+            handle_error(BN_bn2binpad(numbers[i]->get(), field(slot, i),
+                                 static_cast<int>(field_size)) >= 0);
+        }
+    }
+
+    /**
+     * @brief Copies the keys out of the slot and wipes it, the caller holds
+     * the mutex.
+     *
+     * @throws std::runtime_exception if some Bignum operation failed
+     */
+    void load(std::size_t slot, Client_key_shares &shares)
+    {
+        Bignum *numbers[FIELDS] = {&shares.d1_client, &shares.d1_server,
+                &shares.n1, &shares.p, &shares.q};
+
+        for (std::size_t i = 0; i < FIELDS; i++) {
+            handle_error(BN_bin2bn(field(slot, i), static_cast<int>(field_size),
+                                 numbers[i]->get()) != nullptr);
+        }
+
+        OPENSSL_cleanse(field(slot, 0), FIELDS * field_size);
+    }
+};
+
+#endif    // KEY_POOL_HPP
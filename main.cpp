@@ -1,6 +1,8 @@
 #include "client_common.hpp"
 #include "server_common.hpp"
 
+#include <fstream>
+#include <limits>
 #include <memory>
 
 /**
@@ -12,7 +14,38 @@
 /**
  * @brief Enum representing the allowed actions.
  */
-enum class Action { GENERATE, SIGN, VERIFY, TEST, UNKNOWN };
+enum class Action {
+    GENERATE,
+    SIGN,
+    BATCH,
+    VERIFY,
+    TEST,
+    SERVE,
+    PROVISION,
+    POOL,
+    UNKNOWN
+};
+
+/**
+ * @brief Optional parameters following the mode and the action.
+ */
+struct Options
+{
+    unsigned jobs{1};
+    File_format format{File_format::HEX};
+    std::string metrics_file;
+    bool batch{false};
+    std::size_t count{1};
+    std::size_t pool_depth{8};
+    std::size_t client_id{0};
+    std::size_t cache_size{1024};
+    std::size_t max_connections{64};
+    std::string prime_engine{"sieve"};
+    unsigned prime_jobs{1};
+    int modulus_bits{0};
+    bool crt{false};
+    bool screen{false};
+};
 
 /**
  * @brief Prints the usage string.
@@ -22,11 +55,52 @@ enum class Action { GENERATE, SIGN, VERIFY, TEST, UNKNOWN };
 void print_usage(const std::string &path)
 {
     std::cerr << "Unknown parameters.\nUSAGE: " << path
-              << " [client|server] [generate|sign|verify|test]\n"
+              << " [client|server] "
+                 "[generate|sign|batch|verify|test|serve|provision|pool]\n"
+                 "\t[options]\n"
               << "\tgenerate - Generate and save the [client|server] keys\n"
               << "\tsign - Sign the message\n"
+              << "\tbatch - Sign every message of the batch\n"
               << "\tverify - Verify the signature\n"
-              << "\ttest - Single-party key generator self-test\n";
+              << "\ttest - Single-party key generator self-test\n"
+              << "\tserve - Serve signing requests on " SERVER_SOCKET_FILE
+                 " (server only)\n"
+              << "\tprovision - Generate keys of several cards from a key "
+                 "pool (client only)\n"
+              << "\tpool - Pre-generate keys for generate and provision on "
+                 KEY_POOL_SOCKET_FILE "\n\t\t(client only)\n"
+              << "Options:\n"
+              << "\t--jobs N - Number of worker threads, 0 for all cores "
+                 "(default 1)\n"
+              << "\t--batch - Verify every signature of " FINAL_SIGS_BATCH_FILE
+                 " (verify only)\n"
+              << "\t--format hex|binary - Format of written key and signature "
+                 "files (default hex)\n"
+              << "\t--bits N - Client modulus bit length, 1024, 1536, 2048 or "
+                 "3072 (default\n\t\t2048, client generate and provision "
+                 "only), the server follows the\n\t\tclient\n"
+              << "\t--crt - Store the CRT form of the client exponent share "
+                 "in the client\n\t\tkey (client generate and provision "
+                 "only)\n"
+              << "\t--screen - Check the client signatures of the batch by "
+                 "a single product\n\t\tcheck, weaker than one check per "
+                 "signature (server batch\n\t\tonly)\n"
+              << "\t--client ID - Use the indexed key files of the given "
+                 "client, e.g.\n\t\tclient_card.ID.key or server.ID.key\n"
+              << "\t--cache N - Number of clients whose keys are cached by "
+                 "the daemon\n\t\t(default 1024, serve only)\n"
+              << "\t--connections N - Number of connections served by the "
+                 "daemon at once\n\t\t(default 64, serve and pool only)\n"
+              << "\t--count N - Number of provisioned cards (default 1)\n"
+              << "\t--pool-depth N - Number of pre-generated keys (default "
+                 "8)\n"
+              << "\t--prime-engine sieve|random|openssl - Prime generator of "
+                 "the key\n\t\tgeneration (default sieve)\n"
+              << "\t--prime-jobs N - Number of threads racing for every "
+                 "prime, 0 for all\n\t\tcores (default 1, sieve only)\n"
+              << "\t--metrics FILE - Write the stage timers when the action "
+                 "finishes, JSON\n\t\tfor *.json files, Prometheus text "
+                 "format otherwise\n\t\t(requires -DSMPC_INSTRUMENTATION=ON)\n";
 }
 
 /**
@@ -74,31 +148,192 @@ Action parse_action(const std::string &action)
     if (action == "sign")
         return Action::SIGN;
 
+    if (action == "batch")
+        return Action::BATCH;
+
     if (action == "verify")
         return Action::VERIFY;
 
     if (action == "test")
         return Action::TEST;
 
+    if (action == "serve")
+        return Action::SERVE;
+
+    if (action == "provision")
+        return Action::PROVISION;
+
+    if (action == "pool")
+        return Action::POOL;
+
     return Action::UNKNOWN;
 }
 
+/**
+ * @brief Parses the optional parameters following the mode and the action.
+ *
+ * @return true if all parameters are valid, false otherwise
+ */
+bool parse_options(int argc, char *argv[], Options &options)
+{
+    for (int i = 3; i < argc; i++) {
+        const std::string option = argv[i];
+
+        if ((option == "--jobs" || option == "--prime-jobs") &&
+                i + 1 < argc) {
+            unsigned long long value;
+            if (!parse_number(argv[++i], std::numeric_limits<unsigned>::max(),
+                        value))
+                return false;
+
+            (option == "--jobs" ? options.jobs : options.prime_jobs) =
+                    static_cast<unsigned>(value);
+            continue;
+        }
+
+        if (option == "--format" && i + 1 < argc) {
+            const std::string format = argv[++i];
+            if (format != "hex" && format != "binary")
+                return false;
+
+            options.format =
+                    format == "hex" ? File_format::HEX : File_format::BINARY;
+            continue;
+        }
+
+        if (option == "--bits" && i + 1 < argc) {
+            unsigned long long value;
+            if (!parse_number(argv[++i], RSA_MAX_PARTIAL_MODULUS_BITS,
+                        value) ||
+                    !is_supported_modulus_bits(static_cast<int>(value)))
+                return false;
+
+            options.modulus_bits = static_cast<int>(value);
+            continue;
+        }
+
+        if (option == "--prime-engine" && i + 1 < argc) {
+            const std::string engine = argv[++i];
+            if (engine != "sieve" && engine != "random" &&
+                    engine != "openssl")
+                return false;
+
+            options.prime_engine = engine;
+            continue;
+        }
+
+        if (option == "--client" && i + 1 < argc) {
+            if (!parse_client_id(argv[++i], options.client_id))
+                return false;
+            continue;
+        }
+
+        if ((option == "--count" || option == "--pool-depth" ||
+                    option == "--cache" || option == "--connections") &&
+                i + 1 < argc) {
+            unsigned long long value;
+            if (!parse_number(argv[++i],
+                        std::numeric_limits<std::size_t>::max(), value) ||
+                    value == 0)
+                return false;
+
+            if (option == "--count")
+                options.count = value;
+            else if (option == "--pool-depth")
+                options.pool_depth = value;
+            else if (option == "--cache")
+                options.cache_size = value;
+            else
+                options.max_connections = value;
+            continue;
+        }
+
+        if (option == "--batch") {
+            options.batch = true;
+            continue;
+        }
+
+        if (option == "--crt") {
+            options.crt = true;
+            continue;
+        }
+
+        if (option == "--screen") {
+            options.screen = true;
+            continue;
+        }
+
+        if (option == "--metrics" && i + 1 < argc) {
+            options.metrics_file = argv[++i];
+            continue;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Writes the recorded stage timers to the given file. The format is
+ * chosen by the file extension.
+ *
+ * @param path metrics file
+ * @return true on success, false otherwise
+ */
+bool save_metrics(const std::string &path)
+{
+    const std::string json = ".json";
+    const bool is_json = path.size() >= json.size() &&
+            path.compare(path.size() - json.size(), json.size(), json) == 0;
+
+    std::ofstream out(path);
+    write_metrics(out, is_json ? Metrics_format::JSON
+                               : Metrics_format::PROMETHEUS);
+    return static_cast<bool>(out);
+}
+
 /**
  * @brief Main function of the client demo.
  */
 int main(int argc, char *argv[])
 {
-    if (argc != 3) {
+    Options options;
+    if (argc < 3 || !parse_options(argc, argv, options)) {
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
+    if (!options.metrics_file.empty() && !INSTRUMENTATION_ENABLED) {
+        std::cerr << "Metrics are not available, rebuild with "
+                     "-DSMPC_INSTRUMENTATION=ON.\n";
+        return EXIT_FAILURE;
+    }
+
     std::unique_ptr<SMPC_demo> smpc_rsa = get_mode_instance(argv[1]);
     if (!smpc_rsa) {
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
+    smpc_rsa->set_file_format(options.format);
+    smpc_rsa->set_client_id(options.client_id);
+    if (options.modulus_bits != 0 || options.crt) {
+        auto *const client = dynamic_cast<Client *>(smpc_rsa.get());
+        if (!client) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (options.modulus_bits != 0)
+            client->set_modulus_bits(options.modulus_bits);
+        client->set_crt(options.crt);
+    }
+
+    Prime_engine::set_default(
+            Prime_engine::create(options.prime_engine, options.prime_jobs));
+
+    int result = EXIT_SUCCESS;
     try {
         switch (parse_action(argv[2])) {
         case Action::GENERATE:
@@ -109,22 +344,81 @@ int main(int argc, char *argv[])
             smpc_rsa->sign_message();
             break;
 
+        case Action::BATCH:
+            if (options.screen) {
+                auto *const server = dynamic_cast<Server *>(smpc_rsa.get());
+                if (!server) {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+
+                server->set_screening(true);
+            }
+
+            smpc_rsa->sign_batch(options.jobs);
+            break;
+
         case Action::VERIFY:
-            smpc_rsa->verify_final_signature();
+            if (options.batch)
+                smpc_rsa->verify_batch(options.jobs);
+            else
+                smpc_rsa->verify_final_signature();
             break;
 
         case Action::TEST:
-            RSA_keys_generator().run_test();
+            RSA_keys_generator().run_test(options.jobs);
             break;
 
+        case Action::SERVE: {
+            auto *const server = dynamic_cast<Server *>(smpc_rsa.get());
+            if (!server) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            server->set_cache_size(options.cache_size);
+            server->set_max_connections(options.max_connections);
+            server->serve();
+            break;
+        }
+
+        case Action::PROVISION: {
+            auto *const client = dynamic_cast<Client *>(smpc_rsa.get());
+            if (!client) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            client->provision(
+                    options.count, options.pool_depth, options.jobs);
+            break;
+        }
+
+        case Action::POOL: {
+            auto *const client = dynamic_cast<Client *>(smpc_rsa.get());
+            if (!client) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            client->serve_pool(options.pool_depth, options.jobs,
+                    options.max_connections);
+            break;
+        }
+
         default:
             print_usage(argv[0]);
             return EXIT_FAILURE;
         }
     } catch (const std::exception &e) {
         std::cerr << "\x1B[1;31mNOK\x1B[0m\n" << e.what() << '\n';
+        result = EXIT_FAILURE;
+    }
+
+    if (!options.metrics_file.empty() && !save_metrics(options.metrics_file)) {
+        std::cerr << "Could not write the metrics.\n";
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    return result;
 }
@@ -0,0 +1,642 @@
+#include "mod_exp_batch.hpp"
+
+#include <openssl/crypto.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MOD_EXP_BATCH_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+void mod_exp_portable(std::vector<Bignum> &res,
+        const std::vector<Bignum> &bases, const Bignum &exponent,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    for (std::size_t i = 0; i < bases.size(); i++)
+        Bignum::mod_exp_into(res[i], bases[i], exponent, mont, ctx);
+}
+
+#ifdef MOD_EXP_BATCH_X86
+
+const std::size_t LANES = Mod_exp_batch::LANES;
+
+// public moduli of 3072-bit partial keys, R = 2^(52 * 128) = 2^(26 * 256)
+// must exceed 4n
+const int MAX_MODULUS_BITS = 52 * 128 - 2;
+const int MAX_WINDOW = 5;
+
+const int IFMA_LIMB_BITS = 52;
+const std::uint64_t IFMA_LIMB_MASK = (std::uint64_t{1} << IFMA_LIMB_BITS) - 1;
+const int IFMA_MAX_LIMBS = 128;
+
+// products of 26-bit limbs are 52 bits, so every accumulator of 64 bits
+// takes the products of a whole multiplication without carrying
+const int AVX2_LIMB_BITS = 26;
+const std::uint64_t AVX2_LIMB_MASK = (std::uint64_t{1} << AVX2_LIMB_BITS) - 1;
+const int AVX2_MAX_LIMBS = 256;
+// 64-bit elements of a 256-bit vector, i.e. lanes of one vector
+const std::size_t AVX2_LANES = 4;
+
+/**
+ * @brief Buffer wiped by OPENSSL_cleanse when it goes out of scope. The
+ * kernel copies secret primes, exponentiation results and intermediate
+ * powers into such buffers, while Bignums keep them in wiped memory.
+ */
+template <typename T>
+class Wiped_buffer
+{
+    std::vector<T> values;
+
+public:
+    explicit Wiped_buffer(std::size_t size) : values(size) {}
+
+    Wiped_buffer(Wiped_buffer &&) noexcept = default;
+    Wiped_buffer &operator=(Wiped_buffer &&) = delete;
+
+    ~Wiped_buffer()
+    {
+        OPENSSL_cleanse(values.data(), values.size() * sizeof(T));
+    }
+
+    T *data()
+    {
+        return values.data();
+    }
+
+    const T *data() const
+    {
+        return values.data();
+    }
+
+    std::size_t size() const
+    {
+        return values.size();
+    }
+
+    T &operator[](std::size_t i)
+    {
+        return values[i];
+    }
+
+    void clear()
+    {
+        std::fill(values.begin(), values.end(), T{});
+    }
+};
+
+/**
+ * Numbers of all lanes in the radix of the kernel, limb j of lane k is
+ * stored at the index j * LANES + k.
+ */
+using Lane_numbers = Wiped_buffer<std::uint64_t>;
+
+bool has_ifma()
+{
+    static const bool supported = __builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512ifma");
+
+    return supported;
+}
+
+bool has_avx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+/**
+ * @brief Returns true if OpenSSL multiplies by MULX, ADCX and ADOX. The
+ * radix 2^26 kernel needs about 1.5 times more multiplications per lane,
+ * so it is slower than BN_mod_exp_mont then, like the AVX2 code of OpenSSL
+ * which is disabled on such CPUs as well.
+ */
+bool has_adx()
+{
+    static const bool supported = __builtin_cpu_supports("bmi2") &&
+            __builtin_cpu_supports("adx");
+
+    return supported;
+}
+
+/**
+ * @brief Splits a non-negative number smaller than 2^(limb_bits * limbs)
+ * into limbs written with the given stride.
+ */
+void to_limbs(std::uint64_t *out, std::size_t stride, const BIGNUM *num,
+        int limbs, int limb_bits)
+{
+    const std::uint64_t limb_mask = (std::uint64_t{1} << limb_bits) - 1;
+
+    // little-endian bytes, padded for the 8-byte reads below
+    Wiped_buffer<unsigned char> bytes(limbs * limb_bits / 8 + 16);
+    if (BN_bn2lebinpad(num, bytes.data(), static_cast<int>(bytes.size())) < 0)
+        throw std::runtime_error("Number does not fit into the limbs!");
+
+    for (int j = 0; j < limbs; j++) {
+        const int bit = j * limb_bits;
+
+        std::uint64_t word;
+        std::memcpy(&word, bytes.data() + bit / 8, sizeof(word));
+        out[j * stride] = (word >> (bit % 8)) & limb_mask;
+    }
+}
+
+/**
+ * @brief Joins the normalised limbs of one lane into a number.
+ */
+void from_limbs(BIGNUM *num, const std::uint64_t *in, int limbs, int limb_bits)
+{
+    Wiped_buffer<std::uint64_t> words((limbs * limb_bits + 63) / 64 + 1);
+
+    for (int j = 0; j < limbs; j++) {
+        const std::uint64_t limb = in[j * LANES];
+        const int bit = j * limb_bits;
+
+        words[bit / 64] |= limb << (bit % 64);
+        if (bit % 64 > 64 - limb_bits)
+            words[bit / 64 + 1] |= limb >> (64 - bit % 64);
+    }
+
+    // x86-64 is little-endian
+    handle_error(BN_lebin2bn(reinterpret_cast<unsigned char *>(words.data()),
+            static_cast<int>(words.size() * sizeof(std::uint64_t)), num));
+}
+
+/**
+ * @brief Subtracts n from the normalised limbs of every lane which are not
+ * smaller than n. Both passes run whole in every lane, the result is only
+ * selected by masks, so the timing does not depend on the values.
+ */
+void reduce_once(
+        std::uint64_t *r, const std::uint64_t *n, int limbs, int limb_bits)
+{
+    const std::uint64_t limb_mask = (std::uint64_t{1} << limb_bits) - 1;
+
+    for (std::size_t lane = 0; lane < LANES; lane++) {
+        std::uint64_t *const x = r + lane;
+
+        // the top bit of a difference is the borrow
+        std::uint64_t borrow = 0;
+        for (int j = 0; j < limbs; j++)
+            borrow = (x[j * LANES] - n[j] - borrow) >> 63u;
+
+        // all ones if x >= n
+        const std::uint64_t mask = borrow - 1;
+
+        borrow = 0;
+        for (int j = 0; j < limbs; j++) {
+            const std::uint64_t diff = x[j * LANES] - (n[j] & mask) - borrow;
+            borrow = diff >> 63u;
+            x[j * LANES] = diff & limb_mask;
+        }
+    }
+}
+
+/**
+ * @brief Returns the carries of all lanes, i.e. the bits above the low 52.
+ * The zero-masked shift avoids a false -Wmaybe-uninitialized in the GCC
+ * headers.
+ */
+__attribute__((target("avx512f"))) inline __m512i get_carry(__m512i limb)
+{
+    return _mm512_maskz_srli_epi64(0xff, limb, IFMA_LIMB_BITS);
+}
+
+/**
+ * @brief Almost Montgomery multiplication of all lanes, r = a * b / 2^(52 *
+ * limbs) mod n with r < 2n for a, b < 2n. The limbs of the inputs must be
+ * normalised, i.e. smaller than 2^52, the result is normalised as well.
+ * The outer loop accumulates into a sliding window of t, so the partial
+ * sums are never shifted, carries are propagated only at the end.
+ *
+ * @param r result, may alias the inputs
+ * @param n modulus limbs shared by all lanes
+ * @param k0 -n^-1 mod 2^52
+ */
+__attribute__((target("avx512f,avx512ifma"))) void amm_ifma(
+        std::uint64_t *r, const std::uint64_t *a, const std::uint64_t *b,
+        const std::uint64_t *n, std::uint64_t k0, int limbs)
+{
+    // at most 4 * (limbs + 1) products of 52 bits are added to every t[j]
+    __m512i t[2 * IFMA_MAX_LIMBS + 1];
+    for (int j = 0; j <= 2 * limbs; j++)
+        t[j] = _mm512_setzero_si512();
+
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i k = _mm512_set1_epi64(static_cast<long long>(k0));
+
+    for (int i = 0; i < limbs; i++) {
+        __m512i *const ti = t + i;
+        const __m512i ai = _mm512_loadu_si512(a + i * LANES);
+
+        for (int j = 0; j < limbs; j++) {
+            const __m512i bj = _mm512_loadu_si512(b + j * LANES);
+            ti[j] = _mm512_madd52lo_epu64(ti[j], ai, bj);
+            ti[j + 1] = _mm512_madd52hi_epu64(ti[j + 1], ai, bj);
+        }
+
+        // only the low 52 bits of t[i] are used
+        const __m512i m = _mm512_madd52lo_epu64(zero, ti[0], k);
+
+        for (int j = 0; j < limbs; j++) {
+            const __m512i nj = _mm512_set1_epi64(static_cast<long long>(n[j]));
+            ti[j] = _mm512_madd52lo_epu64(ti[j], m, nj);
+            ti[j + 1] = _mm512_madd52hi_epu64(ti[j + 1], m, nj);
+        }
+
+        // the low 52 bits of t[i] are zero now, only the carry is kept
+        ti[1] = _mm512_add_epi64(ti[1], get_carry(ti[0]));
+    }
+
+    const __m512i mask =
+            _mm512_set1_epi64(static_cast<long long>(IFMA_LIMB_MASK));
+    __m512i carry = zero;
+
+    for (int j = 0; j < limbs; j++) {
+        const __m512i sum = _mm512_add_epi64(t[limbs + j], carry);
+        carry = get_carry(sum);
+        _mm512_storeu_si512(r + j * LANES, _mm512_and_si512(sum, mask));
+    }
+}
+
+/**
+ * @brief Copies the table entry of the given index to the result. All
+ * entries are read, so the memory access pattern does not depend on the
+ * index.
+ */
+__attribute__((target("avx512f"))) void select_ifma(std::uint64_t *r,
+        const std::vector<Lane_numbers> &table, unsigned index, int limbs)
+{
+    for (int j = 0; j < limbs; j++) {
+        __m512i limb = _mm512_setzero_si512();
+
+        for (unsigned e = 0; e < table.size(); e++) {
+            const unsigned hit = e == index;
+            const auto mask = static_cast<__mmask8>(0u - hit);
+            limb = _mm512_mask_loadu_epi64(
+                    limb, mask, table[e].data() + j * LANES);
+        }
+
+        _mm512_storeu_si512(r + j * LANES, limb);
+    }
+}
+
+/**
+ * @brief Returns limb j of the AVX2_LANES lanes starting at x.
+ */
+__attribute__((target("avx2"))) inline __m256i load_avx2(
+        const std::uint64_t *x, int j)
+{
+    return _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(x + j * LANES));
+}
+
+/**
+ * @brief Almost Montgomery multiplication of all lanes like amm_ifma, but
+ * in the radix 2^26 by the 32-bit multiplications of AVX2, the lanes are
+ * split into two vectors. Every product fits into 52 bits, so it is added
+ * to t[i + j] whole, and at most 2 * limbs products and a carry are added
+ * to every t[j], which stays below 2^62 for up to 256 limbs.
+ *
+ * @param r result, may alias the inputs
+ * @param n modulus limbs shared by all lanes
+ * @param k0 -n^-1 mod 2^26
+ */
+__attribute__((target("avx2"))) void amm_avx2(std::uint64_t *r,
+        const std::uint64_t *a, const std::uint64_t *b, const std::uint64_t *n,
+        std::uint64_t k0, int limbs)
+{
+    const __m256i k = _mm256_set1_epi64x(static_cast<long long>(k0));
+    const __m256i mask =
+            _mm256_set1_epi64x(static_cast<long long>(AVX2_LIMB_MASK));
+
+    // the vectors only read and write their own lanes, so r may alias
+    for (std::size_t half = 0; half < LANES; half += AVX2_LANES) {
+        __m256i t[2 * AVX2_MAX_LIMBS];
+        for (int j = 0; j < 2 * limbs; j++)
+            t[j] = _mm256_setzero_si256();
+
+        for (int i = 0; i < limbs; i++) {
+            __m256i *const ti = t + i;
+            const __m256i ai = load_avx2(a + half, i);
+
+            // m makes the low 26 bits of t[i] zero, so it needs a * b_0
+            ti[0] = _mm256_add_epi64(ti[0], _mm256_mul_epu32(ai, load_avx2(b + half, 0)));
+            const __m256i m =
+                    _mm256_and_si256(_mm256_mul_epu32(ti[0], k), mask);
+
+            ti[0] = _mm256_add_epi64(ti[0],
+                    _mm256_mul_epu32(m, _mm256_set1_epi64x(
+                                                static_cast<long long>(n[0]))));
+
+            for (int j = 1; j < limbs; j++) {
+                const __m256i nj =
+                        _mm256_set1_epi64x(static_cast<long long>(n[j]));
+                ti[j] = _mm256_add_epi64(ti[j],
+                        _mm256_add_epi64(_mm256_mul_epu32(ai, load_avx2(b + half, j)),
+                                _mm256_mul_epu32(m, nj)));
+            }
+
+            // the low 26 bits of t[i] are zero now, only the carry is kept
+            ti[1] = _mm256_add_epi64(
+                    ti[1], _mm256_srli_epi64(ti[0], AVX2_LIMB_BITS));
+        }
+
+        __m256i carry = _mm256_setzero_si256();
+
+        for (int j = 0; j < limbs; j++) {
+            const __m256i sum = _mm256_add_epi64(t[limbs + j], carry);
+            carry = _mm256_srli_epi64(sum, AVX2_LIMB_BITS);
+            _mm256_storeu_si256(
+                    reinterpret_cast<__m256i *>(r + j * LANES + half),
+                    _mm256_and_si256(sum, mask));
+        }
+    }
+}
+
+/**
+ * @brief Copies the table entry of the given index to the result like
+ * select_ifma, the entries are masked by AVX2 logic operations.
+ */
+__attribute__((target("avx2"))) void select_avx2(std::uint64_t *r,
+        const std::vector<Lane_numbers> &table, unsigned index, int limbs)
+{
+    const std::size_t size = static_cast<std::size_t>(limbs) * LANES;
+
+    for (std::size_t j = 0; j < size; j += AVX2_LANES) {
+        __m256i limb = _mm256_setzero_si256();
+
+        for (unsigned e = 0; e < table.size(); e++) {
+            const unsigned hit = e == index;
+            const __m256i mask =
+                    _mm256_set1_epi64x(-static_cast<long long>(hit));
+            const __m256i entry = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(table[e].data() + j));
+            limb = _mm256_or_si256(limb, _mm256_and_si256(entry, mask));
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(r + j), limb);
+    }
+}
+
+/**
+ * @brief Montgomery arithmetic of a vector kernel.
+ */
+struct Lane_arithmetic
+{
+    int limb_bits;
+    int max_limbs;
+
+    // almost Montgomery multiplication, see amm_ifma
+    void (*amm)(std::uint64_t *r, const std::uint64_t *a,
+            const std::uint64_t *b, const std::uint64_t *n, std::uint64_t k0,
+            int limbs);
+
+    // table lookup independent of the index, see select_ifma
+    void (*select)(std::uint64_t *r, const std::vector<Lane_numbers> &table,
+            unsigned index, int limbs);
+};
+
+const Lane_arithmetic IFMA_ARITHMETIC{
+        IFMA_LIMB_BITS, IFMA_MAX_LIMBS, amm_ifma, select_ifma};
+const Lane_arithmetic AVX2_ARITHMETIC{
+        AVX2_LIMB_BITS, AVX2_MAX_LIMBS, amm_avx2, select_avx2};
+
+/**
+ * @brief Returns the window size minimising the number of multiplications
+ * for the given exponent bit length.
+ */
+int get_window_size(int exponent_bits)
+{
+    int best = 1;
+    long best_cost = -1;
+
+    for (int w = 1; w <= MAX_WINDOW; w++) {
+        // table, squarings and window multiplications
+        const long cost = ((1L << w) - 2) + exponent_bits +
+                (exponent_bits + w - 1) / w;
+        if (best_cost < 0 || cost < best_cost) {
+            best = w;
+            best_cost = cost;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Returns bits [first, first + count) of the exponent.
+ */
+unsigned get_window(const BIGNUM *exponent, int first, int count)
+{
+    unsigned value = 0;
+    for (int bit = first + count - 1; bit >= first; bit--)
+        value = (value << 1u) | (BN_is_bit_set(exponent, bit) ? 1u : 0u);
+
+    return value;
+}
+
+/**
+ * @brief Exponentiates groups of LANES bases by the given arithmetic with
+ * a fixed window.
+ */
+void mod_exp_lanes(const Lane_arithmetic &arithmetic,
+        std::vector<Bignum> &res, const std::vector<Bignum> &bases,
+        const Bignum &exponent, const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    const int limb_bits = arithmetic.limb_bits;
+    const auto amm = arithmetic.amm;
+    const auto select = arithmetic.select;
+
+    const BIGNUM *const n = mont.get_modulus().get();
+    const int limbs = (BN_num_bits(n) + 2 + limb_bits - 1) / limb_bits;
+    if (limbs > arithmetic.max_limbs)
+        throw std::invalid_argument("Modulus is too long for the kernel!");
+
+    Wiped_buffer<std::uint64_t> n_limbs(limbs);
+    to_limbs(n_limbs.data(), 1, n, limbs, limb_bits);
+
+    // -n^-1 mod 2^64 by the Newton iteration, every step doubles the bits
+    std::uint64_t n_inv = n_limbs[0];
+    for (int i = 0; i < 6; i++)
+        n_inv *= 2 - n_limbs[0] * n_inv;
+    const std::uint64_t k0 =
+            (0 - n_inv) & ((std::uint64_t{1} << limb_bits) - 1);
+
+    const std::size_t size = static_cast<std::size_t>(limbs) * LANES;
+    Lane_numbers rr(size), one(size), base(size), acc(size), factor(size);
+
+    // R^2 mod n and R mod n in all lanes, R = 2^(limb_bits * limbs)
+    Bignum tmp;
+    handle_error(BN_set_bit(tmp.get(), 2 * limb_bits * limbs) &&
+            BN_mod(tmp.get(), tmp.get(), n, ctx.get()));
+    for (std::size_t lane = 0; lane < LANES; lane++)
+        to_limbs(rr.data() + lane, LANES, tmp.get(), limbs, limb_bits);
+
+    BN_zero(tmp.get());
+    handle_error(BN_set_bit(tmp.get(), limb_bits * limbs) &&
+            BN_mod(tmp.get(), tmp.get(), n, ctx.get()));
+
+    const int exponent_bits = BN_num_bits(exponent.get());
+    const int w = get_window_size(exponent_bits);
+    const std::size_t entries = std::size_t{1} << w;
+    std::vector<Lane_numbers> table;
+    table.reserve(entries);
+    for (std::size_t i = 0; i < entries; i++)
+        table.emplace_back(size);
+    for (std::size_t lane = 0; lane < LANES; lane++)
+        to_limbs(table[0].data() + lane, LANES, tmp.get(), limbs,
+                limb_bits);
+
+    // plain 1 in all lanes, converts out of the Montgomery form
+    for (std::size_t lane = 0; lane < LANES; lane++)
+        one[lane] = 1;
+
+    for (std::size_t first = 0; first < bases.size(); first += LANES) {
+        const std::size_t count = std::min(LANES, bases.size() - first);
+
+        base.clear();
+        for (std::size_t lane = 0; lane < count; lane++) {
+            const BIGNUM *b = bases[first + lane].get();
+            if (BN_is_negative(b) || BN_ucmp(b, n) >= 0) {
+                handle_error(BN_nnmod(tmp.get(), b, n, ctx.get()));
+                b = tmp.get();
+            }
+
+            to_limbs(base.data() + lane, LANES, b, limbs, limb_bits);
+        }
+
+        // table[i] = base^i in the Montgomery form
+        amm(table[1].data(), base.data(), rr.data(), n_limbs.data(), k0,
+                limbs);
+        for (std::size_t i = 2; i < table.size(); i++)
+            amm(table[i].data(), table[i - 1].data(), table[1].data(),
+                    n_limbs.data(), k0, limbs);
+
+        // the top window may be shorter
+        int bit = (exponent_bits + w - 1) / w * w - w;
+        select(acc.data(), table,
+                get_window(exponent.get(), bit, exponent_bits - bit), limbs);
+
+        while (bit > 0) {
+            bit -= w;
+            for (int i = 0; i < w; i++)
+                amm(acc.data(), acc.data(), acc.data(), n_limbs.data(), k0,
+                        limbs);
+
+            select(factor.data(), table, get_window(exponent.get(), bit, w),
+                    limbs);
+            amm(acc.data(), acc.data(), factor.data(), n_limbs.data(), k0,
+                    limbs);
+        }
+
+        // out of the Montgomery form, the result is at most n
+        amm(acc.data(), acc.data(), one.data(), n_limbs.data(), k0, limbs);
+        reduce_once(acc.data(), n_limbs.data(), limbs, limb_bits);
+
+        for (std::size_t lane = 0; lane < count; lane++) {
+            from_limbs(res[first + lane].get(), acc.data() + lane, limbs,
+                    limb_bits);
+        }
+    }
+}
+
+#endif
+
+}    // namespace
+
+/********************************
+ * Mod_exp_batch implementation *
+ *******************************/
+
+const std::size_t Mod_exp_batch::LANES;
+
+void Mod_exp_batch::mod_exp(std::vector<Bignum> &res,
+        const std::vector<Bignum> &bases, const Bignum &exponent,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    mod_exp(get_kernel(), res, bases, exponent, mont, ctx);
+}
+
+void Mod_exp_batch::mod_exp(Kernel kernel, std::vector<Bignum> &res,
+        const std::vector<Bignum> &bases, const Bignum &exponent,
+        const Bignum_mont_CTX &mont, Bignum_CTX &ctx)
+{
+    if (!is_supported(kernel))
+        throw std::invalid_argument(std::string("Kernel ") +
+                get_kernel_name(kernel) + " is not supported by this CPU!");
+
+    res.resize(bases.size());
+
+#ifdef MOD_EXP_BATCH_X86
+    const int bits = mont.get_modulus().num_bits();
+    if (kernel != Kernel::PORTABLE && !exponent.is_negative() && bits > 0 &&
+            bits <= MAX_MODULUS_BITS) {
+        if (BN_is_zero(exponent.get())) {
+            for (auto &r : res)
+                r = 1ul;
+            return;
+        }
+
+        mod_exp_lanes(kernel == Kernel::AVX512_IFMA ? IFMA_ARITHMETIC
+                                                    : AVX2_ARITHMETIC,
+                res, bases, exponent, mont, ctx);
+        return;
+    }
+#endif
+
+    mod_exp_portable(res, bases, exponent, mont, ctx);
+}
+
+Mod_exp_batch::Kernel Mod_exp_batch::get_kernel()
+{
+#ifdef MOD_EXP_BATCH_X86
+    if (has_ifma())
+        return Kernel::AVX512_IFMA;
+
+    if (has_avx2() && !has_adx())
+        return Kernel::AVX2;
+#endif
+
+    return Kernel::PORTABLE;
+}
+
+bool Mod_exp_batch::is_supported(Kernel kernel)
+{
+    switch (kernel) {
+#ifdef MOD_EXP_BATCH_X86
+    case Kernel::AVX512_IFMA:
+        return has_ifma();
+
+    case Kernel::AVX2:
+        return has_avx2();
+#endif
+
+    case Kernel::PORTABLE:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+const char *Mod_exp_batch::get_kernel_name(Kernel kernel)
+{
+    switch (kernel) {
+    case Kernel::AVX512_IFMA:
+        return "avx512ifma";
+
+    case Kernel::AVX2:
+        return "avx2";
+
+    default:
+        return "portable";
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef MOD_EXP_BATCH_HPP
+#define MOD_EXP_BATCH_HPP
+
+#include "bignum_wrapper.hpp"
+
+#include <vector>
+
+/**
+ * @brief Batched modular exponentiation of many bases by a shared exponent
+ * modulo a shared odd modulus, e.g. signing a batch of messages with one
+ * key or verifying a batch of signatures under one public key.
+ *
+ * The kernel is selected at runtime. The vector kernels run LANES
+ * exponentiations at once, every vector holds one limb of every lane and
+ * Montgomery multiplications of all lanes are done by the same
+ * instructions, in the style of the OpenSSL RSAZ multi-buffer code. On
+ * CPUs with AVX-512 IFMA, the limbs have got 52 bits and fill one 512-bit
+ * vector. On CPUs with AVX2 only, the limbs have got 26 bits, so that
+ * their products fit the 32-bit multiplications, and fill two 256-bit
+ * vectors. The AVX2 kernel is selected only on CPUs without BMI2 and ADX,
+ * where OpenSSL multiplies by the slower MUL and ADC instructions. The
+ * exponentiation uses a fixed window and reads the whole window table for
+ * every window, so its timing does not depend on the exponent bits.
+ * Elsewhere the portable kernel calls BN_mod_exp_mont for every base.
+ */
+class Mod_exp_batch
+{
+public:
+    // exponentiations done by one pass of the vector kernels
+    static const std::size_t LANES{8};
+
+    /**
+     * @brief Implementations of the batched exponentiation.
+     */
+    enum class Kernel
+    {
+        PORTABLE,
+        AVX2,
+        AVX512_IFMA,
+    };
+
+    /**
+     * @brief Computes res[i] = bases[i]^exponent mod n for every base by
+     * the fastest kernel supported by this CPU.
+     *
+     * @param res results, resized to the number of bases
+     * @param bases non-negative bases, reduced modulo n if needed
+     * @param exponent non-negative exponent
+     * @param mont Montgomery context of the modulus n
+     * @param ctx context used for all Bignum operations
+     * @throws std::runtime_error if some Bignum operation failed
+     */
+    static void mod_exp(std::vector<Bignum> &res,
+            const std::vector<Bignum> &bases, const Bignum &exponent,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+
+    /**
+     * @brief Computes the exponentiations like mod_exp by the given kernel,
+     * meant for tests and benchmarks. Moduli too long for the vector
+     * kernels are handled by the portable one.
+     *
+     * @throws std::invalid_argument if the kernel is not supported by this
+     *     CPU
+     * @throws std::runtime_error if some Bignum operation failed
+     */
+    static void mod_exp(Kernel kernel, std::vector<Bignum> &res,
+            const std::vector<Bignum> &bases, const Bignum &exponent,
+            const Bignum_mont_CTX &mont, Bignum_CTX &ctx = Bignum::ctx);
+
+    /**
+     * @return the fastest kernel on this CPU
+     */
+    static Kernel get_kernel();
+
+    /**
+     * @return true if this CPU supports the kernel
+     */
+    static bool is_supported(Kernel kernel);
+
+    /**
+     * @return name of the kernel, i.e. "avx512ifma", "avx2" or "portable"
+     */
+    static const char *get_kernel_name(Kernel kernel = get_kernel());
+};
+
+#endif    // MOD_EXP_BATCH_HPP
@@ -0,0 +1,151 @@
+#include "mod_exp_batch.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/**
+ * Compares the batched modular exponentiation with Bignum::mod_exp for
+ * edge case bases and exponents, moduli handled by the vector kernels and
+ * by the fallback, and batch sizes which are not multiples of the lane
+ * count. Every kernel supported by this CPU is checked.
+ */
+
+/**
+ * @brief Returns a random odd modulus of exactly the given bit length.
+ */
+Bignum random_modulus(int bits)
+{
+    Bignum n;
+    n.set_random_value(bits);
+    n.set_bit(bits - 1);
+    n.set_bit(0);
+
+    return n;
+}
+
+/**
+ * @brief Returns the bases of a batch of the given size. The edge cases
+ * 0, 1, n - 1, n, bases above n and negative bases come first, random bases
+ * below n fill the rest.
+ */
+std::vector<Bignum> create_bases(const Bignum &n, std::size_t count)
+{
+    std::vector<Bignum> edge_cases;
+    edge_cases.emplace_back(0ul);
+    edge_cases.emplace_back(1ul);
+    edge_cases.push_back(n - 1);
+    edge_cases.push_back(n);
+    edge_cases.push_back(n + 5);
+    edge_cases.push_back(n * n + 3);
+
+    Bignum negative(12345ul);
+    BN_set_negative(negative.get(), 1);
+    edge_cases.push_back(negative);
+
+    Bignum negative_large = n + 7;
+    BN_set_negative(negative_large.get(), 1);
+    edge_cases.push_back(negative_large);
+
+    std::vector<Bignum> bases;
+    for (std::size_t i = 0; i < count; i++) {
+        if (i < edge_cases.size()) {
+            bases.push_back(edge_cases[i]);
+            continue;
+        }
+
+        Bignum base;
+        base.set_random_range(n);
+        bases.push_back(base);
+    }
+
+    return bases;
+}
+
+/**
+ * @brief Checks every base of a batch against Bignum::mod_exp.
+ *
+ * @return number of mismatches
+ */
+int check_batch(Mod_exp_batch::Kernel kernel, const Bignum &n,
+        const Bignum &exponent, std::size_t count)
+{
+    const Bignum_mont_CTX mont(n);
+    const std::vector<Bignum> bases = create_bases(n, count);
+
+    std::vector<Bignum> res;
+    Mod_exp_batch::mod_exp(kernel, res, bases, exponent, mont);
+
+    int failures = 0;
+    if (res.size() != bases.size()) {
+        std::cerr << "FAIL: " << Mod_exp_batch::get_kernel_name(kernel)
+                  << ", " << res.size() << " results for "
+                  << bases.size() << " bases\n";
+        return 1;
+    }
+
+    for (std::size_t i = 0; i < bases.size(); i++) {
+        if (res[i] == Bignum::mod_exp(bases[i], exponent, n))
+            continue;
+
+        std::cerr << "FAIL: " << Mod_exp_batch::get_kernel_name(kernel)
+                  << ", " << n.num_bits() << "-bit modulus, "
+                  << exponent.num_bits() << "-bit exponent, batch of "
+                  << count << ", base " << i << '\n';
+        failures++;
+    }
+
+    return failures;
+}
+
+/**
+ * @brief Main function of the test.
+ */
+int main()
+{
+    const std::size_t lanes = Mod_exp_batch::LANES;
+    std::cout << "Default kernel: " << Mod_exp_batch::get_kernel_name()
+              << '\n';
+
+    int failures = 0;
+
+    for (auto kernel :
+            {Mod_exp_batch::Kernel::PORTABLE, Mod_exp_batch::Kernel::AVX2,
+                    Mod_exp_batch::Kernel::AVX512_IFMA}) {
+        if (!Mod_exp_batch::is_supported(kernel)) {
+            std::cout << "Skipping " << Mod_exp_batch::get_kernel_name(kernel)
+                      << '\n';
+            continue;
+        }
+
+        std::cout << "Checking " << Mod_exp_batch::get_kernel_name(kernel)
+                  << '\n';
+
+        // 6654 bits is the longest modulus of the vector kernels, the last
+        // size exceeds them and takes the fallback
+        for (int bits : {512, 1024, 2048, 3072, 4096, 6144, 6654, 7000}) {
+            const Bignum n = random_modulus(bits);
+
+            // long enough for the widest window
+            Bignum secret;
+            secret.set_random_value(std::min(bits, 1024));
+
+            for (const Bignum &exponent :
+                    {Bignum(0ul), Bignum(1ul), Bignum(65537ul), secret}) {
+                for (std::size_t count :
+                        {std::size_t{1}, lanes - 1, lanes, lanes + 1,
+                                2 * lanes + 3})
+                    failures += check_batch(kernel, n, exponent, count);
+            }
+        }
+    }
+
+    if (failures != 0) {
+        std::cerr << failures << " mismatches\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "OK\n";
+    return EXIT_SUCCESS;
+}
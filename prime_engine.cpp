@@ -0,0 +1,302 @@
+#include "prime_engine.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+std::unique_ptr<Prime_engine> default_engine =
+        std::make_unique<Sieve_prime_engine>();
+
+}    // namespace
+
+/***********************************
+ * Prime_statistics implementation *
+ **********************************/
+
+double Prime_statistics::sieve_hit_rate() const
+{
+    return candidates == 0 ? 0.0
+                           : static_cast<double>(sieved_out) /
+                                   static_cast<double>(candidates);
+}
+
+/*******************************
+ * Prime_engine implementation *
+ ******************************/
+
+Prime_statistics Prime_engine::get_statistics() const
+{
+    Prime_statistics stats;
+    stats.primes = counters.primes;
+    stats.candidates = counters.candidates;
+    stats.sieved_out = counters.sieved_out;
+    stats.exponent_filtered = counters.exponent_filtered;
+    stats.primality_tests = counters.primality_tests;
+
+    return stats;
+}
+
+void Prime_engine::reset_statistics()
+{
+    counters.primes = 0;
+    counters.candidates = 0;
+    counters.sieved_out = 0;
+    counters.exponent_filtered = 0;
+    counters.primality_tests = 0;
+}
+
+std::unique_ptr<Prime_engine> Prime_engine::create(
+        const std::string &name, unsigned jobs)
+{
+    if (name == "sieve")
+        return std::make_unique<Sieve_prime_engine>(jobs);
+
+    if (name == "random")
+        return std::make_unique<Random_prime_engine>();
+
+    if (name == "openssl")
+        return std::make_unique<Openssl_prime_engine>();
+
+    throw std::invalid_argument("Unknown prime engine: " + name);
+}
+
+Prime_engine &Prime_engine::get_default()
+{
+    return *default_engine;
+}
+
+void Prime_engine::set_default(std::unique_ptr<Prime_engine> engine)
+{
+    default_engine = std::move(engine);
+}
+
+bool Prime_engine::is_coprime_predecessor(
+        unsigned long residue, unsigned long e)
+{
+    unsigned long a = (residue + e - 1) % e;
+    unsigned long b = e;
+
+    while (a != 0) {
+        const unsigned long tmp = b % a;
+        b = a;
+        a = tmp;
+    }
+
+    return b == 1;
+}
+
+void Prime_engine::generate_random_prime(Bignum &prime, unsigned long e,
+        const Bignum &low, const Bignum &high)
+{
+    const Bignum width = high - low;
+
+    while (true) {
+        prime.set_random_range(width);
+        prime += low;
+        prime.set_bit(0);
+        counters.candidates++;
+
+        if (!is_coprime_predecessor(prime.mod_word(e), e)) {
+            counters.exponent_filtered++;
+            continue;
+        }
+
+        counters.primality_tests++;
+        if (prime.is_prime())
+            break;
+    }
+
+    counters.primes++;
+}
+
+/**************************************
+ * Random_prime_engine implementation *
+ *************************************/
+
+void Random_prime_engine::generate_prime(Bignum &prime, unsigned long e,
+        const Bignum &low, const Bignum &high)
+{
+    generate_random_prime(prime, e, low, high);
+}
+
+const char *Random_prime_engine::get_name() const
+{
+    return "random";
+}
+
+/*************************************
+ * Sieve_prime_engine implementation *
+ ************************************/
+
+const std::size_t Sieve_prime_engine::WINDOW_SIZE;
+const unsigned Sieve_prime_engine::SMALL_PRIMES_LIMIT;
+
+Sieve_prime_engine::Sieve_prime_engine(unsigned jobs)
+    : jobs(jobs == 0 ? std::max(std::thread::hardware_concurrency(), 1u)
+                     : jobs)
+{}
+
+void Sieve_prime_engine::generate_prime(Bignum &prime, unsigned long e,
+        const Bignum &low, const Bignum &high)
+{
+    // the window must fit into the range
+    if (high - low <= Bignum(2 * WINDOW_SIZE)) {
+        generate_random_prime(prime, e, low, high);
+        return;
+    }
+
+    std::atomic<bool> found{false};
+
+    if (jobs == 1) {
+        while (!search_window(prime, e, low, high, found)) {}
+        counters.primes++;
+        return;
+    }
+
+    std::mutex mutex;
+    std::exception_ptr error;
+
+    const auto worker = [&]() {
+        try {
+            Bignum candidate;
+            while (!found) {
+                if (!search_window(candidate, e, low, high, found))
+                    continue;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!found) {
+                    prime.swap(candidate);
+                    found = true;
+                }
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+            found = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < jobs; i++)
+        threads.emplace_back(worker);
+
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+
+    counters.primes++;
+}
+
+const char *Sieve_prime_engine::get_name() const
+{
+    return "sieve";
+}
+
+const std::vector<unsigned long> &Sieve_prime_engine::get_small_primes()
+{
+    // odd primes below the limit by the sieve of Eratosthenes
+    static const std::vector<unsigned long> primes = []() {
+        std::vector<bool> composite(SMALL_PRIMES_LIMIT);
+        std::vector<unsigned long> res;
+
+        for (unsigned long i = 3; i < SMALL_PRIMES_LIMIT; i += 2) {
+            if (composite[i])
+                continue;
+
+            res.push_back(i);
+            for (unsigned long j = i * i; j < SMALL_PRIMES_LIMIT; j += 2 * i)
+                composite[j] = true;
+        }
+
+        return res;
+    }();
+
+    return primes;
+}
+
+bool Sieve_prime_engine::search_window(Bignum &prime, unsigned long e,
+        const Bignum &low, const Bignum &high, const std::atomic<bool> &found)
+{
+    // odd start x, the window covers x, x + 2, ..., x + 2 * (WINDOW_SIZE - 1)
+    Bignum start;
+    start.set_random_range(high - low - 2 * WINDOW_SIZE);
+    start += low;
+    start.set_bit(0);
+
+    // composite[k] marks x + 2k divisible by a small prime
+    std::vector<char> composite(WINDOW_SIZE);
+    for (unsigned long p : get_small_primes()) {
+        // x + 2k = 0 (mod p) <=> k = -x * 2^-1 (mod p), 2^-1 = (p + 1) / 2
+        const unsigned long r = start.mod_word(p);
+        const unsigned long k = (p - r) % p * ((p + 1) / 2) % p;
+
+        for (std::size_t i = k; i < WINDOW_SIZE; i += p)
+            composite[i] = 1;
+    }
+
+    const unsigned long start_mod_e = start.mod_word(e);
+
+    for (std::size_t k = 0; k < WINDOW_SIZE && !found; k++) {
+        counters.candidates++;
+
+        if (composite[k]) {
+            counters.sieved_out++;
+            continue;
+        }
+
+        if (!is_coprime_predecessor((start_mod_e + 2 * k) % e, e)) {
+            counters.exponent_filtered++;
+            continue;
+        }
+
+        prime = start;
+        prime += 2 * k;
+
+        counters.primality_tests++;
+        if (prime.is_prime())
+            return true;
+    }
+
+    return false;
+}
+
+/***************************************
+ * Openssl_prime_engine implementation *
+ **************************************/
+
+void Openssl_prime_engine::generate_prime(Bignum &prime, unsigned long e,
+        const Bignum &low, const Bignum &high)
+{
+    const int bits = (high - 1).num_bits();
+
+    while (true) {
+        handle_error(BN_generate_prime_ex(
+                prime.get(), bits, 0, nullptr, nullptr, nullptr));
+        counters.candidates++;
+
+        if (prime < low || prime >= high)
+            continue;
+
+        if (!is_coprime_predecessor(prime.mod_word(e), e)) {
+            counters.exponent_filtered++;
+            continue;
+        }
+
+        break;
+    }
+
+    counters.primes++;
+}
+
+const char *Openssl_prime_engine::get_name() const
+{
+    return "openssl";
+}
@@ -0,0 +1,166 @@
+#ifndef PRIME_ENGINE_HPP
+#define PRIME_ENGINE_HPP
+
+#include "bignum_wrapper.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Counters of a prime engine.
+ */
+struct Prime_statistics
+{
+    std::uint64_t primes{0};
+    std::uint64_t candidates{0};
+    std::uint64_t sieved_out{0};
+    std::uint64_t exponent_filtered{0};
+    std::uint64_t primality_tests{0};
+
+    /**
+     * @return share of the candidates discarded by the sieve
+     */
+    double sieve_hit_rate() const;
+};
+
+/**
+ * @brief Interface of the prime generators used by the RSA key generation.
+ * Engines may be used by several threads at once.
+ */
+class Prime_engine
+{
+public:
+    virtual ~Prime_engine() = default;
+
+    /**
+     * @brief Generates a random prime p from the range [low, high) such that
+     * gcd(p - 1, e) = 1.
+     *
+     * @param prime generated prime
+     * @param e public exponent
+     * @param low lower bound
+     * @param high upper bound, must be even and greater than low
+     * @throws std::runtime_error if some Bignum operation failed
+     */
+    virtual void generate_prime(Bignum &prime, unsigned long e,
+            const Bignum &low, const Bignum &high) = 0;
+
+    virtual const char *get_name() const = 0;
+
+    Prime_statistics get_statistics() const;
+    void reset_statistics();
+
+    /**
+     * @brief Creates the engine of the given name, i.e. "sieve", "random"
+     * or "openssl".
+     *
+     * @param name engine name
+     * @param jobs number of threads racing for every prime, used only by
+     *     the sieve engine, 0 means one per hardware thread
+     * @return engine
+     * @throws std::invalid_argument if the name is unknown
+     */
+    static std::unique_ptr<Prime_engine> create(
+            const std::string &name, unsigned jobs = 1);
+
+    /**
+     * @brief Returns the engine used by the key generation unless another
+     * one is given. The sieve engine is used until set_default is called.
+     */
+    static Prime_engine &get_default();
+
+    /**
+     * @brief Replaces the default engine. Must not be called while a key
+     * generation is running.
+     */
+    static void set_default(std::unique_ptr<Prime_engine> engine);
+
+protected:
+    struct
+    {
+        std::atomic<std::uint64_t> primes{0};
+        std::atomic<std::uint64_t> candidates{0};
+        std::atomic<std::uint64_t> sieved_out{0};
+        std::atomic<std::uint64_t> exponent_filtered{0};
+        std::atomic<std::uint64_t> primality_tests{0};
+    } counters;
+
+    /**
+     * @brief Checks that gcd(p - 1, e) = 1 using only single-word
+     * arithmetic, as gcd(p - 1, e) = gcd((p - 1) mod e, e).
+     *
+     * @param residue p mod e
+     * @param e public exponent
+     */
+    static bool is_coprime_predecessor(unsigned long residue, unsigned long e);
+
+    /**
+     * @brief Tests uniformly random odd candidates from [low, high) until
+     * a suitable prime is found.
+     */
+    void generate_random_prime(Bignum &prime, unsigned long e,
+            const Bignum &low, const Bignum &high);
+};
+
+/**
+ * @brief Tests independent random candidates, every one of them is checked
+ * by trial division and Miller-Rabin inside OpenSSL.
+ */
+class Random_prime_engine : public Prime_engine
+{
+public:
+    void generate_prime(Bignum &prime, unsigned long e, const Bignum &low,
+            const Bignum &high) override;
+
+    const char *get_name() const override;
+};
+
+/**
+ * @brief Starts at a random odd number and sieves a window of the following
+ * odd candidates by a table of small primes and by the public exponent
+ * condition. Only the survivors are tested by Miller-Rabin. Several threads
+ * may race for the same prime, each of them sieving its own window.
+ */
+class Sieve_prime_engine : public Prime_engine
+{
+    static const std::size_t WINDOW_SIZE{4096};
+    static const unsigned SMALL_PRIMES_LIMIT{1u << 15u};
+
+    unsigned jobs;
+
+public:
+    /**
+     * @param jobs number of racing threads, 0 means one per hardware thread
+     */
+    explicit Sieve_prime_engine(unsigned jobs = 1);
+
+    void generate_prime(Bignum &prime, unsigned long e, const Bignum &low,
+            const Bignum &high) override;
+
+    const char *get_name() const override;
+
+private:
+    static const std::vector<unsigned long> &get_small_primes();
+
+    bool search_window(Bignum &prime, unsigned long e, const Bignum &low,
+            const Bignum &high, const std::atomic<bool> &found);
+};
+
+/**
+ * @brief Generates primes by BN_generate_prime_ex and discards those out
+ * of the range, for comparison with the OpenSSL prime generator. Slow for
+ * ranges much narrower than the numbers with the top two bits set.
+ */
+class Openssl_prime_engine : public Prime_engine
+{
+public:
+    void generate_prime(Bignum &prime, unsigned long e, const Bignum &low,
+            const Bignum &high) override;
+
+    const char *get_name() const override;
+};
+
+#endif    // PRIME_ENGINE_HPP
@@ -2,39 +2,233 @@
 #define RSA_WRAPPER_HPP
 
 #include "bignum_wrapper.hpp"
+#include "mod_exp_batch.hpp"
+#include "prime_engine.hpp"
 
-#include <openssl/rsa.h>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
 /**
- * @brief Wrapper of the RSA struct and used RSA operations defined
- * in the OPENSSL library.
+ * @brief Generator of the two primes of a two-prime RSA modulus.
+ *
+ * Both primes have exactly the half of the modulus bit length with the top
+ * two bits set, therefore their product always has the full bit length.
+ * The primes are searched by a prime engine, which discards candidates p
+ * for which gcd(p - 1, e) != 1 before the primality test.
  */
 class Rsa
 {
-    RSA *value;
+    Bignum p;
+    Bignum q;
 
 public:
-    Rsa(Bignum e, int bits, int primes) : value(RSA_new())
+    /**
+     * @param e public exponent
+     * @param bits modulus bit length
+     * @param engine prime generator
+     * @throws std::runtime_error if some Bignum operation failed
+     */
+    Rsa(unsigned long e, int bits,
+            Prime_engine &engine = Prime_engine::get_default())
     {
+        Bignum low, high;
+        set_prime_range(low, high, bits / 2);
 
-        handle_error(value);
-        handle_error(RSA_generate_multi_prime_key(
-                value, bits, primes, e.get(), nullptr));
+        engine.generate_prime(p, e, low, high);
+
+        do {
+            engine.generate_prime(q, e, low, high);
+        } while (p == q);
+    }
+
+    /**
+     * @brief Generates the primes so that their product n satisfies
+     * min_modulus <= n < 2^bits. The first prime is drawn from the range
+     * making the bound reachable, the second one from the range above
+     * min_modulus / p.
+     *
+     * @param e public exponent
+     * @param bits modulus bit length
+     * @param min_modulus lower bound of the modulus
+     * @param engine prime generator
+     * @throws std::invalid_argument if the lower bound is too close to 2^bits
+     * @throws std::runtime_error if some Bignum operation failed
+     */
+    Rsa(unsigned long e, int bits, const Bignum &min_modulus,
+            Prime_engine &engine = Prime_engine::get_default())
+    {
+        const int half = bits / 2;
+
+        Bignum low, high, min_width;
+        set_prime_range(low, high, half);
+        min_width.set_bit(half / 2);
+
+        const Bignum p_low =
+                std::max(low, Bignum::div(min_modulus, high) + 1);
+        if (high - p_low < min_width)
+            throw std::invalid_argument("Minimal modulus is too large!");
+
+        while (true) {
+            engine.generate_prime(p, e, p_low, high);
+
+            // ceil(min_modulus / p), too narrow ranges are skipped
+            const Bignum q_low =
+                    std::max(low, Bignum::div(min_modulus - 1, p) + 1);
+            if (high - q_low < min_width)
+                continue;
+
+            do {
+                engine.generate_prime(q, e, q_low, high);
+            } while (p == q);
+
+            return;
+        }
+    }
+
+    std::pair<Bignum, Bignum> getPrimes() const &
+    {
+        return {p, q};
     }
 
-    std::pair<Bignum, Bignum> getPrimes() const
+    std::pair<Bignum, Bignum> getPrimes() &&
     {
-        std::vector<const BIGNUM *> primes(
-                RSA_get_multi_prime_extra_count(value) + 2);
-        handle_error(RSA_get0_multi_prime_factors(value, primes.data()));
+        return {std::move(p), std::move(q)};
+    }
 
-        return {primes[0], primes[1]};
+private:
+    /**
+     * @brief Sets the range [3 * 2^(bits - 2), 2^bits) of the numbers of
+     * the given bit length with the top two bits set.
+     */
+    static void set_prime_range(Bignum &low, Bignum &high, int bits)
+    {
+        low.set_bit(bits - 1);
+        low.set_bit(bits - 2);
+        high.set_bit(bits);
+    }
+};
+
+/**
+ * @brief CRT representation of an RSA private exponent d of a two-prime
+ * modulus p * q, i.e. d mod (p - 1), d mod (q - 1) and q^-1 mod p,
+ * together with the Montgomery contexts of both primes.
+ */
+class Rsa_crt
+{
+    Bignum p;
+    Bignum q;
+    Bignum d_p;
+    Bignum d_q;
+    Bignum q_inv;
+
+    Bignum_mont_CTX mont_p;
+    Bignum_mont_CTX mont_q;
+
+public:
+    Rsa_crt(Bignum p, Bignum q, Bignum d_p, Bignum d_q, Bignum q_inv)
+        : p(std::move(p)), q(std::move(q)), d_p(std::move(d_p)),
+          d_q(std::move(d_q)), q_inv(std::move(q_inv)), mont_p(this->p),
+          mont_q(this->q)
+    {}
+
+    /**
+     * @brief Computes the CRT parameters of the private exponent d.
+     *
+     * @param p first prime
+     * @param q second prime
+     * @param d private exponent
+     * @return CRT representation of d
+     * @throws std::runtime_error if some Bignum operation failed
+     */
+    static Rsa_crt from_primes(const Bignum &p, const Bignum &q, const Bignum &d)
+    {
+        Bignum d_p = d;
+        d_p.mod(p - 1);
+
+        Bignum d_q = d;
+        d_q.mod(q - 1);
+
+        return {p, q, std::move(d_p), std::move(d_q), Bignum::inverse(q, p)};
+    }
+
+    /**
+     * @brief Computes res = a^d mod p * q using the Garner's formula
+     * res = a^d_q mod q + q * ((a^d_p mod p - a^d_q mod q) * q^-1 mod p).
+     *
+     * @param res result
+     * @param a base
+     * @param ctx context used for all Bignum operations
+     * @throws std::runtime_error if some Bignum operation failed
+     */
+    void mod_exp_into(
+            Bignum &res, const Bignum &a, Bignum_CTX &ctx = Bignum::ctx) const
+    {
+        Bignum_scope scope(ctx);
+        Bignum &m_p = scope.get();
+        Bignum &m_q = scope.get();
+
+        Bignum::mod_exp_into(m_p, a, d_p, mont_p, ctx);
+        Bignum::mod_exp_into(m_q, a, d_q, mont_q, ctx);
+
+        m_p -= m_q;
+        m_p.mod_mul_self(q_inv, p, ctx);
+
+        Bignum::mul_into(res, m_p, q, ctx);
+        res += m_q;
+    }
+
+    /**
+     * @brief Computes res[i] = bases[i]^d mod p * q for every base like
+     * mod_exp_into, the half-size exponentiations of all bases are batched.
+     *
+     * @param res results, resized to the number of bases
+     * @param bases bases
+     * @param ctx context used for all Bignum operations
+     * @throws std::runtime_error if some Bignum operation failed
+     */
+    void mod_exp_batch_into(std::vector<Bignum> &res,
+            const std::vector<Bignum> &bases,
+            Bignum_CTX &ctx = Bignum::ctx) const
+    {
+        std::vector<Bignum> m_p, m_q;
+        Mod_exp_batch::mod_exp(m_p, bases, d_p, mont_p, ctx);
+        Mod_exp_batch::mod_exp(m_q, bases, d_q, mont_q, ctx);
+
+        res.resize(bases.size());
+        for (std::size_t i = 0; i < bases.size(); i++) {
+            m_p[i] -= m_q[i];
+            m_p[i].mod_mul_self(q_inv, p, ctx);
+
+            Bignum::mul_into(res[i], m_p[i], q, ctx);
+            res[i] += m_q[i];
+        }
+    }
+
+    const Bignum &get_p() const
+    {
+        return p;
+    }
+
+    const Bignum &get_q() const
+    {
+        return q;
+    }
+
+    const Bignum &get_d_p() const
+    {
+        return d_p;
+    }
+
+    const Bignum &get_d_q() const
+    {
+        return d_q;
     }
 
-    ~Rsa()
+    const Bignum &get_q_inv() const
     {
-        RSA_free(value);
+        return q_inv;
     }
 };
 
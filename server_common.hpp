@@ -2,10 +2,285 @@
 #define SERVER_COMMON_HPP
 
 #include "common.hpp"
+#include "socket_wrapper.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * @brief Server keys needed to finish the client signature share and to
+ * compute the final signature together with values derived only from
+ * the keys, i.e. n1^-1 mod n2 and the Montgomery contexts of both moduli.
+ * Derived values are computed and the keys are validated only once.
+ *
+ * If the CRT representation of d2 is present, it is used instead of d2.
+ */
+struct Server_keys
+{
+    Bignum d1_server;
+    Bignum n1;
+    Bignum d2;
+    Bignum n2;
+    Bignum n1_inv;
+    int bits;
+    std::unique_ptr<const Rsa_crt> crt_d2;
+
+    Bignum_mont_CTX mont_n1;
+    Bignum_mont_CTX mont_n2;
+
+    /**
+     * @throws std::runtime_exception if n1_inv is not the inverse of n1
+     *     modulo n2 or some Bignum operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    Server_keys(Bignum d1_server, Bignum n1, Bignum d2, Bignum n2,
+            Bignum n1_inv, std::unique_ptr<const Rsa_crt> crt_d2 = nullptr)
+        : d1_server(std::move(d1_server)), n1(std::move(n1)),
+          d2(std::move(d2)), n2(std::move(n2)), n1_inv(std::move(n1_inv)),
+          bits(check(this->d1_server, this->n1, this->d2, this->n2,
+                  this->n1_inv)),
+          crt_d2(std::move(crt_d2)), mont_n1(this->n1), mont_n2(this->n2)
+    {}
+
+private:
+    /**
+     * @brief Checks the keys before the Montgomery contexts are built, so
+     * that invalid moduli are not reported as OpenSSL errors.
+     *
+     * @return partial modulus bit length
+     * @throws std::runtime_exception if n1_inv is not the inverse of n1
+     *     modulo n2 or some Bignum operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    static int check(const Bignum &d1_server, const Bignum &n1,
+            const Bignum &d2, const Bignum &n2, const Bignum &n1_inv)
+    {
+        const int bits = check_partial_modulus(n1);
+        if (check_partial_modulus(n2) != bits)
+            throw std::out_of_range("Client and server moduli must have got "
+                                    "the same bit length!");
+
+        check_num_bits(n1 * n2, bits * 2);
+
+        // precise check is impossible without phi(n)
+        if (d1_server >= n1 || d2 >= n2)
+            throw std::out_of_range("Private exponent cannot be greater than "
+                                    "or equal to the partial modulus!");
+
+        Bignum check = n1_inv;
+        check.mod_mul_self(n1, n2);
+        if (!check.is_one())
+            throw std::runtime_error("Stored n1^-1 mod n2 is invalid!");
+
+        return bits;
+    }
+};
+
+/**
+ * @brief Cache of parsed and validated server keys of many clients
+ * addressed by client IDs, the least recently used keys are evicted first.
+ * Cached keys include the derived values, so hot clients never hit the
+ * disk or the parser. Keys are shared, i.e. evicted keys stay valid while
+ * a request uses them. May be used by several threads at once.
+ */
+class Key_store
+{
+public:
+    using Loader = std::function<std::shared_ptr<const Server_keys>(
+            std::size_t)>;
+
+private:
+    using Entry = std::pair<std::size_t, std::shared_ptr<const Server_keys>>;
+
+    const std::size_t capacity;
+    const Loader loader;
+
+    std::mutex mutex;
+    // the most recently used entry first
+    std::list<Entry> entries;
+    std::unordered_map<std::size_t, std::list<Entry>::iterator> index;
+
+public:
+    /**
+     * @param capacity maximal number of cached keys
+     * @param loader loads the keys of the given client
+     */
+    Key_store(std::size_t capacity, Loader loader)
+        : capacity(std::max<std::size_t>(capacity, 1)),
+          loader(std::move(loader))
+    {}
+
+    /**
+     * @brief Returns the keys of the client, loads them on a cache miss.
+     * Keys are loaded outside the lock, so concurrent misses of one client
+     * may load its keys more than once.
+     *
+     * @param id client ID
+     * @return server keys of the client
+     * @throws what the loader throws, failed loads are not cached
+     */
+    std::shared_ptr<const Server_keys> get(std::size_t id)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (const auto keys = find(id))
+                return keys;
+        }
+
+        auto keys = loader(id);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (const auto cached = find(id))
+            return cached;
+
+        entries.emplace_front(id, std::move(keys));
+        index[id] = entries.begin();
+
+        if (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+
+        return entries.front().second;
+    }
+
+private:
+    /**
+     * @brief Looks the client up and marks it as the most recently used,
+     * the mutex must be held.
+     */
+    std::shared_ptr<const Server_keys> find(std::size_t id)
+    {
+        const auto it = index.find(id);
+        if (it == index.end())
+            return nullptr;
+
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+};
+
+/**
+ * @brief Persistent thread running one task at a time on behalf of another
+ * thread, e.g. the server halves of the signatures of one daemon
+ * connection. All tasks use the Bignum context and the scratch Bignums of
+ * the helper thread, so nothing is set up per task. Tasks are started and
+ * waited for by a single thread.
+ */
+class Helper_thread
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::function<void()> task;
+    std::exception_ptr error;
+    bool running{false};
+    bool stopping{false};
+
+    // started last, it uses the members above
+    std::thread thread;
+
+public:
+    Helper_thread() : thread([this]() { run(); }) {}
+
+    ~Helper_thread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        changed.notify_all();
+        thread.join();
+    }
+
+    Helper_thread(const Helper_thread &) = delete;
+    Helper_thread &operator=(const Helper_thread &) = delete;
+
+    /**
+     * @brief Starts the task, the previous one must have been waited for.
+     *
+     * @param new_task task to be run by the helper thread
+     */
+    void start(std::function<void()> new_task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = std::move(new_task);
+            error = nullptr;
+            running = true;
+        }
+
+        changed.notify_all();
+    }
+
+    /**
+     * @brief Waits until the started task finishes.
+     *
+     * @return exception thrown by the task, nullptr if it succeeded
+     */
+    std::exception_ptr wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return !running; });
+
+        return error;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            changed.wait(lock, [this]() { return running || stopping; });
+            if (!running)
+                return;
+
+            lock.unlock();
+            std::exception_ptr task_error;
+            try {
+                task();
+            } catch (...) {
+                task_error = std::current_exception();
+            }
+            lock.lock();
+
+            error = task_error;
+            task = nullptr;
+            running = false;
+            changed.notify_all();
+        }
+    }
+};
 
 class Server : public SMPC_demo
 {
+    static const std::size_t DEFAULT_CACHE_SIZE{1024};
+    static const std::size_t DEFAULT_MAX_CONNECTIONS{64};
+
+    // optional "CLIENT <id> " prefix and two hex numbers smaller than the
+    // largest partial modulus separated by a space
+    static const std::size_t MAX_REQUEST_LENGTH{
+            sizeof("CLIENT ") - 1 + std::numeric_limits<std::size_t>::digits10 +
+            2 + 2 * (RSA_MAX_PARTIAL_MODULUS_BITS / 4) + 1};
+
+    // unread input discarded before closing a connection
+    static const std::size_t MAX_DISCARDED_INPUT{1 << 20};
+
+    std::size_t cache_size{DEFAULT_CACHE_SIZE};
+    std::size_t max_connections{DEFAULT_MAX_CONNECTIONS};
+    bool screening{false};
+
 public:
     /**
      * @brief Generates and saves the server keys.
@@ -16,18 +291,26 @@ public:
      */
     void generate_keys() override
     {
-        if (std::ifstream(SERVER_KEYS_FILE) && std::ifstream(PUBLIC_KEY_FILE) &&
-                !regenerate_keys())
+        if (std::ifstream(key_file(SERVER_KEYS_FILE)) &&
+                std::ifstream(key_file(PUBLIC_KEY_FILE)) && !regenerate_keys())
             return;
 
-        const auto client = get_client_keys();
+        auto client = get_client_keys(key_file(CLIENT_KEYS_SERVER_SHARE_FILE));
 
+        // n2 is generated to be coprime with n1 and to give n of twice
+        // the bit length of n1
+        get_partial_modulus_bits(client.second);
         RSA_keys_generator rsa{true};
-        rsa.generate_RSA_keys();
+        rsa.generate_RSA_keys(client.second);
 
+        std::cout << "Computing public key... " << std::flush;
         const auto n = multiply_and_check_moduli(client.second, rsa.get_n());
+        std::cout << "\x1B[1;32mOK\x1B[0m\n";
+
+        const Server_keys keys = create_keys(
+                std::move(client.first), std::move(client.second), rsa);
 
-        save_keys(client.first, client.second, rsa.get_d2(), rsa.get_n(), n);
+        save_keys(keys, n);
     }
 
     /**
@@ -43,48 +326,29 @@ public:
         std::cout << "Signing... " << std::flush;
 
         // Load the keys and partial signature
-        std::ifstream server(SERVER_KEYS_FILE), sign(CLIENT_SIG_SHARE_FILE);
-        if (!server || !sign)
-            throw std::runtime_error(
-                    "Could read the given keys or client signature.");
-
-        Bignum d1_server, n1, d2, n2, m, y;
-        server >> d1_server >> n1 >> d2 >> n2;
-        sign >> m >> y;
+        const Server_keys keys = load_keys(key_file(SERVER_KEYS_FILE));
 
-        if (!server || !sign)
-            throw std::runtime_error(
-                    "Could read the given keys or client signature.");
+        std::ifstream sign(CLIENT_SIG_SHARE_FILE, std::ios::binary);
+        if (!sign)
+            throw std::runtime_error("Could read the client signature.");
 
-        // Check valid input
-        check_message_exponent_and_modulus(
-                m, d1_server, n1, RSA_PARTIAL_MODULUS_BITS);
-        check_message_exponent_and_modulus(m, d2, n2, RSA_PARTIAL_MODULUS_BITS);
-        check_num_bits(n1 * n2, RSA_PARTIAL_MODULUS_BITS * 2);
-
-        // Finish and check the client signature
-        Bignum s1 = Bignum::mod_exp(m, d1_server, n1);
-        s1.mod_mul_self(y, n1);
-
-        Bignum m_test = Bignum::mod_exp(s1, RSA_PUBLIC_EXP, n1);
-        if (m != m_test)
-            throw std::runtime_error(
-                    "Fraudulent or corrupt client signature detected!");
+        // m, y
+        const std::vector<Bignum> input = read_all_bignums(sign);
+        if (input.size() != 2)
+            throw std::runtime_error("Could read the client signature.");
 
-        // Compute the full signature
-        // s = (((s2 - s1) / n1) mod n2) * n1 + s1
-        Bignum s = Bignum::mod_exp(m, d2, n2) - s1;
-        s.mod_mul_self(Bignum::inverse(n1, n2), n2);
-        s *= n1;
-        s += s1;
+        const Bignum &m = input[0];
+        const auto helper = create_helper();
+        const Bignum s =
+                compute_signature_concurrently(keys, m, input[1], helper.get());
 
         // Save the signature
-        std::ofstream out(FINAL_SIG_FILE);
+        std::ofstream out(FINAL_SIG_FILE, std::ios::binary);
         if (!out)
             throw std::runtime_error(
                     "Could not write out the final signature.");
 
-        out << m << '\n' << s << '\n';
+        write_bignums(out, {m, s}, format);
 
         if (!out)
             throw std::runtime_error(
@@ -93,31 +357,482 @@ public:
         std::cout << "\x1B[1;32mOK\x1B[0m\n";
     }
 
-private:
     /**
-     * @brief Reads and returns the server share of client keys.
+     * @brief Finishes and checks authenticity of every client signature
+     * share from the batch file. After that computes and saves the final
+     * signatures. With screening enabled, the finished client signatures
+     * are checked together by screen_client_signatures instead of one by
+     * one.
      *
-     * @return pair containing the server share of the client key
-     *     and client modulus in this order
-     * @throws std::runtime_exception if an IO problem occurs
-     * @throws std::out_of_range if the client modulus bit length test fails
+     * @param jobs number of worker threads, 0 means one per hardware thread
+     * @throws std::runtime_exception if an IO problem occurs or some Bignum
+     *     operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
      */
-    static std::pair<Bignum, Bignum> get_client_keys()
+    void sign_batch(unsigned jobs) override
     {
-        std::cout << "Loading client keys... " << std::flush;
+        std::cout << "Signing batch... " << std::flush;
 
-        std::ifstream in(CLIENT_KEYS_SERVER_SHARE_FILE);
-        if (!in)
-            throw std::runtime_error("Client keys have not been generated!");
+        const Server_keys keys = load_keys(key_file(SERVER_KEYS_FILE));
 
-        Bignum d1_server, n1;
-        in >> d1_server >> n1;
+        std::ifstream sign(CLIENT_SIG_SHARES_BATCH_FILE, std::ios::binary);
+        if (!sign)
+            throw std::runtime_error("Could read the client signatures.");
 
-        if (!in)
-            throw std::runtime_error("Could not read the client keys!");
+        // message and client signature share pairs
+        const std::vector<Bignum> input = read_all_bignums(sign);
+        if (input.size() % 2 != 0)
+            throw std::runtime_error("Client signature is missing for the "
+                                     "last message.");
 
-        std::cout << "\x1B[1;32mOK\x1B[0m\n";
-        return {d1_server, n1};
+        std::vector<Bignum> signatures(input.size() / 2);
+
+        // finished client signatures, screened after all groups are done
+        std::vector<Bignum> client_signatures(
+                screening ? signatures.size() : 0);
+
+        // groups of messages are signed by the batched exponentiation
+        const std::size_t group = Mod_exp_batch::LANES;
+        const std::size_t groups = (signatures.size() + group - 1) / group;
+
+        run_parallel(groups, jobs, [&](std::size_t g) {
+            const std::size_t first = g * group;
+            const std::size_t last =
+                    std::min(first + group, signatures.size());
+
+            std::vector<Bignum> m, y;
+            for (std::size_t i = first; i < last; i++) {
+                m.push_back(input[2 * i]);
+                y.push_back(input[2 * i + 1]);
+            }
+
+            try {
+                std::vector<Bignum> s1, s;
+                if (screening) {
+                    finish_client_signatures(s1, keys, m, y);
+                    compute_server_signatures(s, keys, m);
+                    std::move(s1.begin(), s1.end(),
+                            client_signatures.begin() + first);
+                } else {
+                    s = compute_signatures(keys, m, y);
+                }
+
+                std::move(s.begin(), s.end(), signatures.begin() + first);
+                return;
+            } catch (const std::exception &) {
+                // signed one by one below to find the failing message
+            }
+
+            for (std::size_t i = first; i < last; i++) {
+                const Bignum &m_i = input[2 * i];
+                const Bignum &y_i = input[2 * i + 1];
+
+                try {
+                    if (!screening) {
+                        signatures[i] = compute_signature(keys, m_i, y_i);
+                        continue;
+                    }
+
+                    // checked one by one, combined after the screening
+                    check_message(keys, m_i);
+                    finish_client_signature(
+                            client_signatures[i], keys, m_i, y_i);
+                    compute_server_signature(signatures[i], keys, m_i);
+                } catch (const std::exception &e) {
+                    throw std::runtime_error("Message " +
+                            std::to_string(i + 1) + ": " + e.what());
+                }
+            }
+        });
+
+        if (screening) {
+            std::vector<Bignum> messages;
+            messages.reserve(signatures.size());
+            for (std::size_t i = 0; i < signatures.size(); i++)
+                messages.push_back(input[2 * i]);
+
+            std::size_t bad;
+            {
+                TIME_STAGE(FRAUD_CHECK);
+                bad = screen_client_signatures(keys, messages,
+                        client_signatures, 0, signatures.size());
+            }
+
+            if (bad != signatures.size())
+                throw std::runtime_error("Message " + std::to_string(bad + 1) +
+                        ": Fraudulent or corrupt client signature detected!");
+
+            run_parallel(signatures.size(), jobs, [&](std::size_t i) {
+                combine_signatures(signatures[i], keys, client_signatures[i]);
+            });
+        }
+
+        std::vector<std::reference_wrapper<const Bignum>> output;
+        output.reserve(input.size());
+        for (std::size_t i = 0; i < signatures.size(); i++) {
+            output.emplace_back(input[2 * i]);
+            output.emplace_back(signatures[i]);
+        }
+
+        std::ofstream out(FINAL_SIGS_BATCH_FILE, std::ios::binary);
+        write_bignums(out, output, format);
+
+        if (!out)
+            throw std::runtime_error(
+                    "Could not write out the final signatures.");
+
+        std::cout << "\x1B[1;32mOK\x1B[0m (" << signatures.size()
+                  << " messages)\n";
+    }
+
+    /**
+     * @brief Finishes and checks authenticity of the client signature share
+     * and computes the final signature. Uses only the given context, so
+     * it may be called concurrently with distinct contexts.
+     *
+     * @param keys server keys
+     * @param m message
+     * @param y client signature share
+     * @param ctx context used for all Bignum operations
+     * @return final signature
+     * @throws std::runtime_exception if the client signature is fraudulent
+     *     or some Bignum operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    static Bignum compute_signature(const Server_keys &keys, const Bignum &m,
+            const Bignum &y, Bignum_CTX &ctx = Bignum::ctx)
+    {
+        check_message(keys, m);
+
+        Bignum_scope scope(ctx);
+        Bignum &s1 = scope.get();
+
+        Bignum s;
+        finish_client_signature(s1, keys, m, y, ctx);
+        compute_server_signature(s, keys, m, ctx);
+        combine_signatures(s, keys, s1, ctx);
+
+        return s;
+    }
+
+    /**
+     * @brief Computes the final signature like compute_signature, but the
+     * server signature share is computed by the helper thread while the
+     * calling one finishes the client signature share. Both halves are
+     * joined before the recombination, so the latency is given by the
+     * slower half instead of their sum. Meant for single requests, batches
+     * are split across threads by groups of messages instead.
+     *
+     * @param keys server keys
+     * @param m message
+     * @param y client signature share
+     * @param helper helper thread created by create_helper, nullptr
+     *     computes both halves by the calling thread
+     * @return final signature
+     * @throws std::runtime_exception if the client signature is fraudulent
+     *     or some Bignum operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    static Bignum compute_signature_concurrently(const Server_keys &keys,
+            const Bignum &m, const Bignum &y, Helper_thread *helper)
+    {
+        if (!helper)
+            return compute_signature(keys, m, y);
+
+        check_message(keys, m);
+
+        Bignum_scope scope;
+        Bignum &s1 = scope.get();
+
+        // the helper uses the context of its own thread
+        Bignum s;
+        helper->start([&]() { compute_server_signature(s, keys, m); });
+
+        try {
+            finish_client_signature(s1, keys, m, y);
+        } catch (...) {
+            // the task refers to the local variables
+            helper->wait();
+            throw;
+        }
+
+        if (const auto error = helper->wait())
+            std::rethrow_exception(error);
+
+        combine_signatures(s, keys, s1);
+        return s;
+    }
+
+    /**
+     * @brief Creates the helper thread of compute_signature_concurrently,
+     * which is meant to be reused by all signatures of a connection.
+     *
+     * @return helper thread, nullptr on single-core machines, where there
+     *     is nothing to gain from computing the halves concurrently
+     */
+    static std::unique_ptr<Helper_thread> create_helper()
+    {
+        // decided once, the number of cores does not change
+        static const bool multicore = std::thread::hardware_concurrency() > 1;
+
+        return multicore ? std::make_unique<Helper_thread>() : nullptr;
+    }
+
+    /**
+     * @brief Computes the final signatures of many messages like
+     * compute_signature, but every exponentiation, including the checks, is
+     * done for all messages at once by Mod_exp_batch.
+     *
+     * @param keys server keys
+     * @param m messages
+     * @param y client signature shares of the messages
+     * @param ctx context used for all Bignum operations
+     * @return final signatures
+     * @throws std::runtime_exception if some client signature is fraudulent
+     *     or some Bignum operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    static std::vector<Bignum> compute_signatures(const Server_keys &keys,
+            const std::vector<Bignum> &m, const std::vector<Bignum> &y,
+            Bignum_CTX &ctx = Bignum::ctx)
+    {
+        std::vector<Bignum> s1, s;
+        finish_client_signatures(s1, keys, m, y, ctx);
+        check_client_signatures(keys, m, s1, ctx);
+        compute_server_signatures(s, keys, m, ctx);
+
+        for (std::size_t i = 0; i < m.size(); i++)
+            combine_signatures(s[i], keys, s1[i], ctx);
+
+        return s;
+    }
+
+    /**
+     * @brief Checks the messages and finishes their client signature shares
+     * like finish_client_signature by the batched exponentiation, but does
+     * not check the finished signatures.
+     *
+     * @param s1 finished client signatures
+     * @param keys server keys
+     * @param m messages
+     * @param y client signature shares of the messages
+     * @param ctx context used for all Bignum operations
+     * @throws std::runtime_exception if some Bignum operation failed
+     * @throws std::out_of_range if some message is out of range
+     */
+    static void finish_client_signatures(std::vector<Bignum> &s1,
+            const Server_keys &keys, const std::vector<Bignum> &m,
+            const std::vector<Bignum> &y, Bignum_CTX &ctx = Bignum::ctx)
+    {
+        for (const Bignum &message : m)
+            check_message(keys, message);
+
+        TIME_STAGE(SERVER_FINISH_EXP);
+        Mod_exp_batch::mod_exp(s1, m, keys.d1_server, keys.mont_n1, ctx);
+        for (std::size_t i = 0; i < m.size(); i++)
+            s1[i].mod_mul_self(y[i], keys.n1, ctx);
+    }
+
+    /**
+     * @brief Checks that s1[i]^e = m[i] mod n1 for every finished client
+     * signature by the batched exponentiation.
+     *
+     * @throws std::runtime_exception if some client signature is fraudulent
+     *     or some Bignum operation failed
+     */
+    static void check_client_signatures(const Server_keys &keys,
+            const std::vector<Bignum> &m, const std::vector<Bignum> &s1,
+            Bignum_CTX &ctx = Bignum::ctx)
+    {
+        TIME_STAGE(FRAUD_CHECK);
+
+        std::vector<Bignum> m_test;
+        Mod_exp_batch::mod_exp(
+                m_test, s1, Bignum{RSA_PUBLIC_EXP}, keys.mont_n1, ctx);
+        if (m != m_test)
+            throw std::runtime_error(
+                    "Fraudulent or corrupt client signature detected!");
+    }
+
+    /**
+     * @brief Screens the finished client signatures s1[first, last) by
+     * a single check of their product, (s1[first] * ... * s1[last - 1])^e
+     * = m[first] * ... * m[last - 1] mod n1. If the product does not match,
+     * the range is split in halves until the first bad signature is found,
+     * so a batch of honest signatures costs one exponentiation.
+     *
+     * The screening is weaker than checking every signature: corrupt
+     * signatures pass if their errors cancel out in the product, e.g.
+     * s1[i] * c and s1[j] * c^-1. Only meant for batches of a single
+     * trusted client, e.g. to detect faults rather than fraud.
+     *
+     * @param keys server keys
+     * @param m messages
+     * @param s1 finished client signatures of the messages
+     * @param first first screened signature
+     * @param last end of the screened signatures
+     * @param ctx context used for all Bignum operations
+     * @return index of the first signature failing the screening, last if
+     *     all pass
+     * @throws std::runtime_exception if some Bignum operation failed
+     */
+    static std::size_t screen_client_signatures(const Server_keys &keys,
+            const std::vector<Bignum> &m, const std::vector<Bignum> &s1,
+            std::size_t first, std::size_t last,
+            Bignum_CTX &ctx = Bignum::ctx)
+    {
+        if (first == last)
+            return last;
+
+        {
+            Bignum_scope scope(ctx);
+            Bignum &m_product = scope.get();
+            Bignum &s1_product = scope.get();
+            Bignum &m_test = scope.get();
+
+            // k Montgomery multiplications scale both products by R^-k,
+            // they are rescaled by R^k at the end
+            const Bignum_mont_CTX &mont = keys.mont_n1;
+            m_product.set(1);
+            s1_product.set(1);
+            for (std::size_t i = first; i < last; i++) {
+                Bignum::mont_mul_into(m_product, m_product, m[i], mont, ctx);
+                Bignum::mont_mul_into(
+                        s1_product, s1_product, s1[i], mont, ctx);
+            }
+
+            Bignum &scale = m_test;
+            scale.set(1);
+            Bignum::to_mont_into(scale, scale, mont, ctx);
+            Bignum::mod_exp_word_into(scale, scale, last - first, mont, ctx);
+            m_product.mod_mul_self(scale, keys.n1, ctx);
+            s1_product.mod_mul_self(scale, keys.n1, ctx);
+
+            Bignum::mod_exp_word_into(
+                    m_test, s1_product, RSA_PUBLIC_EXP, keys.mont_n1, ctx);
+            if (m_test == m_product)
+                return last;
+        }
+
+        if (last - first == 1)
+            return first;
+
+        // one of the halves fails, otherwise their product would pass
+        const std::size_t middle = first + (last - first) / 2;
+        const std::size_t bad =
+                screen_client_signatures(keys, m, s1, first, middle, ctx);
+        if (bad != middle)
+            return bad;
+
+        return screen_client_signatures(keys, m, s1, middle, last, ctx);
+    }
+
+    /**
+     * @brief Computes the server signatures s2[i] = m[i]^d2 mod n2 like
+     * compute_server_signature by the batched exponentiation.
+     *
+     * @throws std::runtime_exception if some Bignum operation failed
+     */
+    static void compute_server_signatures(std::vector<Bignum> &s2,
+            const Server_keys &keys, const std::vector<Bignum> &m,
+            Bignum_CTX &ctx = Bignum::ctx)
+    {
+        TIME_STAGE(SERVER_EXP);
+
+        if (!keys.crt_d2) {
+            Mod_exp_batch::mod_exp(s2, m, keys.d2, keys.mont_n2, ctx);
+            return;
+        }
+
+        keys.crt_d2->mod_exp_batch_into(s2, m, ctx);
+
+        std::vector<Bignum> m_test;
+        Mod_exp_batch::mod_exp(
+                m_test, s2, Bignum{RSA_PUBLIC_EXP}, keys.mont_n2, ctx);
+        if (m != m_test)
+            throw std::runtime_error("Server signature check failed!");
+    }
+
+    /**
+     * @brief Finishes the client signature share, i.e.
+     * s1 = m^d1_server * y mod n1, and checks that s1^e = m mod n1.
+     *
+     * @param s1 finished client signature
+     * @param keys server keys
+     * @param m message
+     * @param y client signature share
+     * @param ctx context used for all Bignum operations
+     * @throws std::runtime_exception if the client signature is fraudulent
+     *     or some Bignum operation failed
+     */
+    static void finish_client_signature(Bignum &s1, const Server_keys &keys,
+            const Bignum &m, const Bignum &y, Bignum_CTX &ctx = Bignum::ctx)
+    {
+        Bignum_scope scope(ctx);
+        Bignum &m_test = scope.get();
+
+        {
+            TIME_STAGE(SERVER_FINISH_EXP);
+            Bignum::mod_exp_into(s1, m, keys.d1_server, keys.mont_n1, ctx);
+            s1.mod_mul_self(y, keys.n1, ctx);
+        }
+
+        TIME_STAGE(FRAUD_CHECK);
+        Bignum::mod_exp_word_into(
+                m_test, s1, RSA_PUBLIC_EXP, keys.mont_n1, ctx);
+        if (m != m_test)
+            throw std::runtime_error(
+                    "Fraudulent or corrupt client signature detected!");
+    }
+
+    /**
+     * @brief Computes the server signature s2 = m^d2 mod n2. The CRT result
+     * is checked to prevent leaking factors of n2 by a faulty computation.
+     *
+     * @param s2 server signature
+     * @param keys server keys
+     * @param m message
+     * @param ctx context used for all Bignum operations
+     * @throws std::runtime_exception if some Bignum operation failed
+     */
+    static void compute_server_signature(Bignum &s2, const Server_keys &keys,
+            const Bignum &m, Bignum_CTX &ctx = Bignum::ctx)
+    {
+        TIME_STAGE(SERVER_EXP);
+
+        if (!keys.crt_d2) {
+            Bignum::mod_exp_into(s2, m, keys.d2, keys.mont_n2, ctx);
+            return;
+        }
+
+        keys.crt_d2->mod_exp_into(s2, m, ctx);
+
+        Bignum_scope scope(ctx);
+        Bignum &m_test = scope.get();
+        Bignum::mod_exp_word_into(
+                m_test, s2, RSA_PUBLIC_EXP, keys.mont_n2, ctx);
+        if (m != m_test)
+            throw std::runtime_error("Server signature check failed!");
+    }
+
+    /**
+     * @brief Combines the client and server signatures into the full
+     * signature s = (((s2 - s1) / n1) mod n2) * n1 + s1.
+     *
+     * @param s server signature, replaced by the full signature
+     * @param keys server keys
+     * @param s1 finished client signature
+     * @param ctx context used for all Bignum operations
+     * @throws std::runtime_exception if some Bignum operation failed
+     */
+    static void combine_signatures(Bignum &s, const Server_keys &keys,
+            const Bignum &s1, Bignum_CTX &ctx = Bignum::ctx)
+    {
+        TIME_STAGE(RECOMBINATION);
+        s -= s1;
+        s.mod_mul_self(keys.n1_inv, keys.n2, ctx);
+        s.mul_self(keys.n1, ctx);
+        s += s1;
     }
 
     /**
@@ -130,49 +845,304 @@ private:
      * @throws std::out_of_range public modulus has got wrong bit length
      * @throws std::runtime_error if a Bignum error occurs
      */
-    Bignum multiply_and_check_moduli(const Bignum &n1, const Bignum &n2)
+    static Bignum multiply_and_check_moduli(const Bignum &n1, const Bignum &n2)
     {
-        std::cout << "Computing public key... " << std::flush;
-
-        check_num_bits(n1, RSA_PARTIAL_MODULUS_BITS);
-        check_num_bits(n2, RSA_PARTIAL_MODULUS_BITS);
+        const int bits = get_partial_modulus_bits(n1);
+        check_num_bits(n2, bits);
 
         if (Bignum::gcd(n1, n2) != 1)
             throw std::runtime_error(
                     "Client and server moduli must be comprime!");
 
         Bignum n = n1 * n2;
-        check_num_bits(n, RSA_PARTIAL_MODULUS_BITS * 2);
+        check_num_bits(n, bits * 2);
 
-        std::cout << "\x1B[1;32mOK\x1B[0m\n";
         return n;
     }
 
+    /**
+     * @brief Derives the server keys from the server share of the client
+     * keys and freshly generated server RSA keys.
+     *
+     * @param d1_server server share of the client private exponent
+     * @param n1 client modulus
+     * @param rsa server RSA keys
+     * @return server keys
+     * @throws std::runtime_exception if some Bignum operation failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    static Server_keys create_keys(
+            Bignum d1_server, Bignum n1, const RSA_keys_generator &rsa)
+    {
+        auto crt_d2 = std::make_unique<const Rsa_crt>(
+                Rsa_crt::from_primes(rsa.get_p(), rsa.get_q(), rsa.get_d2()));
+        Bignum n1_inv = Bignum::inverse(n1, rsa.get_n());
+
+        return {std::move(d1_server), std::move(n1), rsa.get_d2(), rsa.get_n(),
+                std::move(n1_inv), std::move(crt_d2)};
+    }
+
+    /**
+     * @brief Loads the server keys once and serves signing requests on
+     * a Unix socket until the process is terminated. Every connection is
+     * handled by its own thread and may carry any number of requests.
+     *
+     * A request is a line containing the message and the client signature
+     * share in hex separated by whitespace, optionally preceded by "CLIENT"
+     * and a decimal client ID. The reply is a line containing the final
+     * signature in hex or "ERROR" followed by the reason.
+     *
+     * Requests longer than the longest valid one are answered by "ERROR
+     * Request too long" and their connection is closed. At most the given
+     * number of connections are served at once, further ones wait in the
+     * listen queue. Accepting is retried if the process runs out of file
+     * descriptors or threads.
+     *
+     * Requests without a client ID use the keys of the selected client,
+     * if they exist. Keys of the other clients are read from their indexed
+     * key files on the first request and kept in a key store.
+     *
+     * @throws std::runtime_exception if an IO problem occurs or some Bignum
+     *     operation failed
+     */
+    void serve()
+    {
+        std::shared_ptr<const Server_keys> keys;
+        if (std::ifstream(key_file(SERVER_KEYS_FILE))) {
+            std::cout << "Loading keys... " << std::flush;
+            keys = std::make_shared<const Server_keys>(
+                    load_keys(key_file(SERVER_KEYS_FILE)));
+            std::cout << "\x1B[1;32mOK\x1B[0m\n";
+        }
+
+        const auto store = std::make_shared<Key_store>(
+                cache_size, [](std::size_t id) {
+                    return std::make_shared<const Server_keys>(
+                            load_keys(indexed_file(SERVER_KEYS_FILE, id)));
+                });
+
+        std::cout << "Listening on " SERVER_SOCKET_FILE "... " << std::flush;
+        const Unix_socket listener = Unix_socket::listen_on(SERVER_SOCKET_FILE);
+        std::cout << "\x1B[1;32mOK\x1B[0m\n";
+
+        serve_connections(listener, max_connections,
+                [keys, store](Unix_socket connection) {
+                    handle_connection(keys, *store, std::move(connection));
+                });
+    }
+
+    /**
+     * @brief Sets the number of connections served by the signing daemon
+     * at once.
+     *
+     * @param count maximal number of connections
+     */
+    void set_max_connections(std::size_t count)
+    {
+        max_connections = count;
+    }
+
+    /**
+     * @brief Sets the number of clients whose keys are cached by the
+     * signing daemon.
+     *
+     * @param size key cache size
+     */
+    void set_cache_size(std::size_t size)
+    {
+        cache_size = size;
+    }
+
+    /**
+     * @brief Enables screening of the client signatures of batches by
+     * a single product check, see screen_client_signatures.
+     *
+     * @param enabled true to screen batches
+     */
+    void set_screening(bool enabled)
+    {
+        screening = enabled;
+    }
+
+private:
+    /**
+     * @brief Checks that the message is smaller than both partial moduli,
+     * the keys have been checked when loaded.
+     *
+     * @throws std::out_of_range if the check fails
+     */
+    static void check_message(const Server_keys &keys, const Bignum &m)
+    {
+        TIME_STAGE(BOUND_CHECK);
+        if (m >= keys.n1 || m >= keys.n2)
+            throw std::out_of_range("Message cannot be greater than or "
+                                    "equal to the partial modulus!");
+    }
+
+    /**
+     * @brief Reads, validates and returns the server keys. The CRT
+     * parameters of d2 and n1^-1 mod n2 are optional, n1^-1 mod n2 is
+     * computed if it is missing.
+     *
+     * @param file server key file
+     * @return server keys
+     * @throws std::runtime_exception if an IO problem occurs, the stored
+     *     derived values do not match the keys or some Bignum operation
+     *     failed
+     * @throws std::out_of_range if an Bignum bit length test fails
+     */
+    static Server_keys load_keys(const std::string &file)
+    {
+        std::ifstream server(file, std::ios::binary);
+        if (!server)
+            throw std::runtime_error("Server keys have not been generated!");
+
+        // d1_server, n1, d2, n2 [, p, q, d_p, d_q, q_inv [, n1_inv]]
+        std::vector<Bignum> keys = read_all_bignums(server);
+        if (keys.size() != 4 && keys.size() != 9 && keys.size() != 10)
+            throw std::runtime_error("Could not read the server keys!");
+
+        Bignum n1_inv = keys.size() == 10 ? std::move(keys[9])
+                                          : Bignum::inverse(keys[1], keys[3]);
+
+        std::unique_ptr<const Rsa_crt> crt_d2;
+        if (keys.size() >= 9) {
+            if (keys[4] * keys[5] != keys[3])
+                throw std::runtime_error(
+                        "Server CRT parameters do not match the modulus!");
+
+            crt_d2 = std::make_unique<const Rsa_crt>(std::move(keys[4]),
+                    std::move(keys[5]), std::move(keys[6]), std::move(keys[7]),
+                    std::move(keys[8]));
+        }
+
+        return {std::move(keys[0]), std::move(keys[1]), std::move(keys[2]),
+                std::move(keys[3]), std::move(n1_inv), std::move(crt_d2)};
+    }
+
+    /**
+     * @brief Answers all signing requests received on the connection.
+     *
+     * @param keys server keys of requests without a client ID, may be null
+     * @param store keys of the other clients
+     * @param connection connected client
+     */
+    static void handle_connection(
+            const std::shared_ptr<const Server_keys> &keys, Key_store &store,
+            Unix_socket connection)
+    {
+        try {
+            const auto helper = create_helper();
+            std::string request;
+            Line_status status;
+
+            while ((status = connection.read_line(
+                            request, MAX_REQUEST_LENGTH)) ==
+                    Line_status::COMPLETE)
+                connection.write_line(handle_request(
+                        keys, store, helper.get(), request));
+
+            if (status == Line_status::TOO_LONG) {
+                connection.write_line("ERROR Request too long");
+                connection.discard_input(MAX_DISCARDED_INPUT);
+            }
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << '\n';
+        }
+    }
+
+    /**
+     * @brief Computes the final signature for a single signing request.
+     *
+     * @param keys server keys of requests without a client ID, may be null
+     * @param store keys of the other clients
+     * @param helper helper thread of the connection, may be null
+     * @param request optional client ID, message and client signature share
+     * @return final signature in hex or the error description
+     */
+    static std::string handle_request(
+            const std::shared_ptr<const Server_keys> &keys, Key_store &store,
+            Helper_thread *helper, const std::string &request)
+    {
+        const std::string prefix = "CLIENT ";
+        const bool has_id = request.compare(0, prefix.size(), prefix) == 0;
+
+        std::istringstream in(has_id ? request.substr(prefix.size()) : request);
+        std::string id_text;
+        std::size_t id = 0;
+        Bignum m, y;
+        std::string rest;
+
+        if ((has_id && !(in >> id_text && parse_client_id(id_text, id))) ||
+                !(in >> m >> y) || in >> rest)
+            return "ERROR Malformed request";
+
+        if (!has_id && !keys)
+            return "ERROR Client ID is missing";
+
+        try {
+            const auto client_keys = has_id ? store.get(id) : keys;
+
+            std::ostringstream out;
+            out << compute_signature_concurrently(*client_keys, m, y, helper);
+            return out.str();
+        } catch (const std::exception &e) {
+            return std::string("ERROR ") + e.what();
+        }
+    }
+
+    /**
+     * @brief Reads and returns the server share of client keys.
+     *
+     * @param file server share of the client keys
+     * @return pair containing the server share of the client key
+     *     and client modulus in this order
+     * @throws std::runtime_exception if an IO problem occurs
+     * @throws std::out_of_range if the client modulus bit length test fails
+     */
+    static std::pair<Bignum, Bignum> get_client_keys(const std::string &file)
+    {
+        std::cout << "Loading client keys... " << std::flush;
+
+        std::ifstream in(file, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Client keys have not been generated!");
+
+        // d1_server, n1
+        std::vector<Bignum> keys = read_all_bignums(in);
+        if (keys.size() != 2)
+            throw std::runtime_error("Could not read the client keys!");
+
+        std::cout << "\x1B[1;32mOK\x1B[0m\n";
+        return {std::move(keys[0]), std::move(keys[1])};
+    }
+
     /**
      * @brief Saves generated keys to corresponding files, one for the server
      * itself and the other for general public.
      *
-     * @param d1_server - server share of the client private exponent (d''_1)
-     * @param n1 - client modulus
-     * @param d2 - server private exponent (d_2)
-     * @param n1 - client modulus
+     * @param keys - server keys including the CRT parameters of d2
      * @param n - public modulus
      * @throws std::runtime_exception if an IO problem occurs
-     * @throws std::out_of_range if the client modulus bit length test fails
      */
-    void save_keys(const Bignum &d1_server, const Bignum &n1, const Bignum &d2,
-            const Bignum &n2, const Bignum &n)
+    void save_keys(const Server_keys &keys, const Bignum &n)
     {
         std::cout << "Storing keys... " << std::flush;
 
-        std::ofstream server(SERVER_KEYS_FILE), public_key(PUBLIC_KEY_FILE);
+        std::ofstream server(key_file(SERVER_KEYS_FILE), std::ios::binary),
+                public_key(key_file(PUBLIC_KEY_FILE), std::ios::binary);
         if (!server || !public_key)
             throw std::runtime_error("Could not save the keys!");
 
-        server << d1_server << '\n' << n1 << '\n' << d2 << '\n' << n2 << '\n';
+        const Rsa_crt &crt_d2 = *keys.crt_d2;
+        write_bignums(server,
+                {keys.d1_server, keys.n1, keys.d2, keys.n2, crt_d2.get_p(),
+                        crt_d2.get_q(), crt_d2.get_d_p(), crt_d2.get_d_q(),
+                        crt_d2.get_q_inv(), keys.n1_inv},
+                format);
 
-        public_key << std::hex << RSA_PUBLIC_EXP << std::dec << '\n'
-                   << n << '\n';
+        const Bignum e{RSA_PUBLIC_EXP};
+        write_bignums(public_key, {e, n}, format);
 
         if (!server || !public_key)
             throw std::runtime_error("Could not save the keys!");
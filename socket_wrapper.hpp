@@ -0,0 +1,352 @@
+#ifndef SOCKET_WRAPPER_HPP
+#define SOCKET_WRAPPER_HPP
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#define ACCEPT_RETRY_MS 100
+
+/**
+ * @brief Error of a socket operation which may succeed when retried later,
+ * e.g. accepting a connection while out of file descriptors.
+ */
+class Transient_socket_error : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Result of reading a line from a socket.
+ */
+enum class Line_status
+{
+    COMPLETE,
+    CLOSED,
+    TOO_LONG,
+};
+
+/**
+ * @brief Wrapper of a connected or listening Unix domain stream socket.
+ * Connected sockets are read and written line by line.
+ */
+class Unix_socket
+{
+    int fd;
+    std::string buffer;
+
+public:
+    explicit Unix_socket(int fd) : fd(fd)
+    {
+        if (fd == -1)
+            throw_errno("Could not create the socket");
+    }
+
+    Unix_socket(const Unix_socket &) = delete;
+    Unix_socket &operator=(const Unix_socket &) = delete;
+
+    Unix_socket(Unix_socket &&other) noexcept
+        : fd(other.fd), buffer(std::move(other.buffer))
+    {
+        other.fd = -1;
+    }
+
+    ~Unix_socket()
+    {
+        if (fd != -1)
+            close(fd);
+    }
+
+    /**
+     * @brief Creates a socket listening on the given path. A stale socket
+     * file left at the path is replaced.
+     *
+     * @param path socket path
+     * @param owner_only whether only the owner may connect to the socket
+     * @return listening socket
+     * @throws std::runtime_error if the socket could not be created
+     */
+    static Unix_socket listen_on(
+            const std::string &path, bool owner_only = false)
+    {
+        Unix_socket socket{::socket(AF_UNIX, SOCK_STREAM, 0)};
+        const sockaddr_un address = make_address(path);
+
+        // permissions are changed before anybody can connect
+        unlink(path.c_str());
+        if (bind(socket.fd, reinterpret_cast<const sockaddr *>(&address),
+                    sizeof(address)) == -1 ||
+                (owner_only &&
+                        chmod(path.c_str(), S_IRUSR | S_IWUSR) == -1) ||
+                listen(socket.fd, SOMAXCONN) == -1)
+            throw_errno("Could not listen on " + path);
+
+        return socket;
+    }
+
+    /**
+     * @brief Connects to the socket listening on the given path.
+     *
+     * @param path socket path
+     * @return connected socket, nullptr if nothing listens on the path
+     * @throws std::runtime_error if connecting failed otherwise
+     */
+    static std::unique_ptr<Unix_socket> connect_to(const std::string &path)
+    {
+        auto socket = std::make_unique<Unix_socket>(
+                ::socket(AF_UNIX, SOCK_STREAM, 0));
+        const sockaddr_un address = make_address(path);
+
+        if (connect(socket->fd, reinterpret_cast<const sockaddr *>(&address),
+                    sizeof(address)) == 0)
+            return socket;
+
+        if (errno == ENOENT || errno == ECONNREFUSED)
+            return nullptr;
+
+        throw_errno("Could not connect to " + path);
+    }
+
+    /**
+     * @brief Waits for a new connection on a listening socket. Connections
+     * aborted by the peer before they were accepted are skipped.
+     *
+     * @return connected socket
+     * @throws Transient_socket_error if the process or the system ran out
+     *     of file descriptors or memory
+     * @throws std::runtime_error if accepting failed otherwise
+     */
+    Unix_socket accept_connection() const
+    {
+        int client;
+        do {
+            client = accept(fd, nullptr, nullptr);
+        } while (client == -1 &&
+                (errno == EINTR || errno == ECONNABORTED || errno == EPROTO));
+
+        if (client == -1 && (errno == EMFILE || errno == ENFILE ||
+                                    errno == ENOBUFS || errno == ENOMEM))
+            throw Transient_socket_error(std::string("Could not accept a "
+                                                     "connection: ") +
+                    std::strerror(errno));
+
+        return Unix_socket{client};
+    }
+
+    /**
+     * @brief Reads a line without the trailing newline. Longer lines are
+     * not buffered whole, the rest of the line is left unread.
+     *
+     * @param line read line
+     * @param max_length maximal length of the line
+     * @return Line_status::CLOSED if the peer closed the connection before
+     *     a whole line was received, Line_status::TOO_LONG if the line is
+     *     longer than max_length, Line_status::COMPLETE otherwise
+     * @throws std::runtime_error if reading failed
+     */
+    Line_status read_line(std::string &line, std::size_t max_length)
+    {
+        std::size_t end;
+        while ((end = buffer.find('\n')) == std::string::npos) {
+            if (buffer.size() > max_length)
+                return Line_status::TOO_LONG;
+
+            char chunk[4096];
+            const ssize_t count = recv(fd, chunk, sizeof(chunk), 0);
+
+            if (count == -1 && errno == EINTR)
+                continue;
+
+            if (count == -1)
+                throw_errno("Could not read from the socket");
+
+            if (count == 0)
+                return Line_status::CLOSED;
+
+            buffer.append(chunk, static_cast<std::size_t>(count));
+        }
+
+        if (end > max_length)
+            return Line_status::TOO_LONG;
+
+        line.assign(buffer, 0, end);
+        buffer.erase(0, end + 1);
+        return Line_status::COMPLETE;
+    }
+
+    /**
+     * @brief Discards the received data which has not been read yet,
+     * without waiting for more. Closing a socket with unread data resets
+     * the connection, so the peer could lose the last reply.
+     *
+     * @param max_length maximal number of discarded bytes
+     */
+    void discard_input(std::size_t max_length)
+    {
+        buffer.clear();
+
+        for (std::size_t discarded = 0; discarded < max_length;) {
+            char chunk[4096];
+            const ssize_t count = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+
+            if (count == -1 && errno == EINTR)
+                continue;
+
+            if (count <= 0)
+                return;
+
+            discarded += static_cast<std::size_t>(count);
+        }
+    }
+
+    /**
+     * @brief Writes the whole line followed by a newline.
+     *
+     * @param line line to be written
+     * @throws std::runtime_error if writing failed
+     */
+    void write_line(const std::string &line)
+    {
+        const std::string data = line + '\n';
+
+        for (std::size_t sent = 0; sent < data.size();) {
+            const ssize_t count = send(fd, data.data() + sent,
+                    data.size() - sent, MSG_NOSIGNAL);
+
+            if (count == -1 && errno == EINTR)
+                continue;
+
+            if (count == -1)
+                throw_errno("Could not write to the socket");
+
+            sent += static_cast<std::size_t>(count);
+        }
+    }
+
+private:
+    static sockaddr_un make_address(const std::string &path)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Socket path is too long: " + path);
+
+        path.copy(address.sun_path, path.size());
+        return address;
+    }
+
+    [[noreturn]] static void throw_errno(const std::string &message)
+    {
+        throw std::runtime_error(message + ": " + std::strerror(errno));
+    }
+};
+
+/**
+ * @brief Counter of the connections served at once. Acquiring a slot waits
+ * while all of them are taken. May be used by several threads at once.
+ */
+class Connection_slots
+{
+    const std::size_t capacity;
+
+    std::mutex mutex;
+    std::condition_variable released;
+    std::size_t used{0};
+
+public:
+    /**
+     * @param capacity maximal number of connections served at once
+     */
+    explicit Connection_slots(std::size_t capacity)
+        : capacity(std::max<std::size_t>(capacity, 1))
+    {}
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [this]() { return used < capacity; });
+        used++;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            used--;
+        }
+
+        released.notify_one();
+    }
+};
+
+/**
+ * @brief Accepts connections on the listening socket and passes every one
+ * to the handler on its own thread. At most max_connections connections are
+ * handled at once, further ones wait in the listen queue. Accepting is
+ * retried if the process runs out of file descriptors or threads.
+ *
+ * @param listener listening socket
+ * @param max_connections maximal number of connections handled at once
+ * @param handler connection handler, exceptions thrown by it are logged
+ * @throws std::runtime_error if accepting failed otherwise
+ */
+inline void serve_connections(const Unix_socket &listener,
+        std::size_t max_connections,
+        std::function<void(Unix_socket)> handler)
+{
+    // shared with the connection threads, which may outlive the call
+    const auto slots = std::make_shared<Connection_slots>(max_connections);
+    const auto shared_handler =
+            std::make_shared<const std::function<void(Unix_socket)>>(
+                    std::move(handler));
+
+    const auto handle = [slots, shared_handler](Unix_socket connection) {
+        try {
+            (*shared_handler)(std::move(connection));
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << '\n';
+        }
+
+        slots->release();
+    };
+
+    while (true) {
+        slots->acquire();
+
+        try {
+            std::thread(handle, listener.accept_connection()).detach();
+        } catch (const Transient_socket_error &e) {
+            slots->release();
+            std::cerr << e.what() << ", retrying\n";
+            std::this_thread::sleep_for(
+                    std::chrono::milliseconds(ACCEPT_RETRY_MS));
+        } catch (const std::system_error &e) {
+            // the connection is closed, as the thread did not take it
+            slots->release();
+            std::cerr << "Could not start a connection thread: " << e.what()
+                      << '\n';
+            std::this_thread::sleep_for(
+                    std::chrono::milliseconds(ACCEPT_RETRY_MS));
+        }
+    }
+}
+
+#endif    // SOCKET_WRAPPER_HPP
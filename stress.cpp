@@ -0,0 +1,245 @@
+#include "client_common.hpp"
+#include "server_common.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+
+/**
+ * In-process stress test of the SMPC RSA Demo protocol. Every round
+ * generates the client and server keys, signs a random message by both
+ * parties and verifies the final signature without touching any files.
+ */
+
+/**
+ * @brief Stress test parameters.
+ */
+struct Options
+{
+    std::size_t rounds{1000};
+    unsigned jobs{0};
+    bool verbose{false};
+};
+
+/**
+ * @brief Stages of a single protocol round.
+ */
+enum Stage {
+    CLIENT_KEYGEN,
+    SERVER_KEYGEN,
+    MODULI_CHECK,
+    CLIENT_SIGN,
+    SERVER_SIGN,
+    VERIFY,
+    STAGE_COUNT
+};
+
+const std::array<const char *, STAGE_COUNT> STAGE_NAMES = {"client keygen",
+        "server keygen", "moduli check", "client sign", "server sign",
+        "verify"};
+
+/**
+ * @brief Statistics shared by all worker threads.
+ */
+struct Statistics
+{
+    std::atomic<std::size_t> moduli_failures{0};
+    std::atomic<std::size_t> errors{0};
+    std::array<std::atomic<std::int64_t>, STAGE_COUNT> stage_ns{};
+};
+
+/**
+ * @brief Prints the usage string.
+ *
+ * @param path relative path to the executable
+ */
+void print_usage(const std::string &path)
+{
+    std::cerr << "USAGE: " << path << " [options]\n"
+              << "\t--rounds N - Number of protocol rounds (default 1000)\n"
+              << "\t--jobs N - Number of parallel rounds, 0 for the number "
+                 "of hardware threads (default 0)\n"
+              << "\t--verbose - Print the result of every round\n";
+}
+
+/**
+ * @brief Parses the command line parameters.
+ *
+ * @return true if all parameters are valid, false otherwise
+ */
+bool parse_options(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; i++) {
+        const std::string option = argv[i];
+
+        if (option == "--verbose") {
+            options.verbose = true;
+            continue;
+        }
+
+        if ((option == "--rounds" || option == "--jobs") && i + 1 < argc) {
+            const bool rounds = option == "--rounds";
+            unsigned long long value;
+            if (!parse_number(argv[++i],
+                        rounds ? std::numeric_limits<std::size_t>::max()
+                               : std::numeric_limits<unsigned>::max(),
+                        value))
+                return false;
+
+            if (rounds) {
+                if (value == 0)
+                    return false;
+                options.rounds = value;
+            } else {
+                options.jobs = static_cast<unsigned>(value);
+            }
+            continue;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Runs a single protocol round.
+ *
+ * @param stats statistics to be updated
+ * @return false if the moduli are unusable, true if the round passed
+ * @throws std::runtime_error if the protocol failed
+ */
+bool run_round(Statistics &stats)
+{
+    using clock = std::chrono::steady_clock;
+    auto last = clock::now();
+
+    const auto finish_stage = [&](Stage stage) {
+        const auto now = clock::now();
+        stats.stage_ns[stage] +=
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - last)
+                        .count();
+        last = now;
+    };
+
+    RSA_keys_generator client;
+    client.set_verbose(false);
+    client.generate_RSA_keys();
+    finish_stage(CLIENT_KEYGEN);
+
+    RSA_keys_generator server{true};
+    server.set_verbose(false);
+    server.generate_RSA_keys(client.get_n());
+    finish_stage(SERVER_KEYGEN);
+
+    Bignum n;
+    try {
+        n = Server::multiply_and_check_moduli(client.get_n(), server.get_n());
+    } catch (const std::exception &) {
+        finish_stage(MODULI_CHECK);
+        return false;
+    }
+
+    const Server_keys server_keys =
+            Server::create_keys(client.get_d1_server(), client.get_n(), server);
+    const Client_keys client_keys{client.get_d1_client(), client.get_n()};
+    finish_stage(MODULI_CHECK);
+
+    Bignum m;
+    m.set_random_value(static_cast<int>(RSA_DEFAULT_PARTIAL_MODULUS_BITS) - 1);
+
+    const Bignum y = Client::compute_signature_share(client_keys, m);
+    finish_stage(CLIENT_SIGN);
+
+    const Bignum s = Server::compute_signature(server_keys, m, y);
+    finish_stage(SERVER_SIGN);
+
+    const bool valid = Verifier{n}.verify(m, s);
+    finish_stage(VERIFY);
+
+    if (!valid)
+        throw std::runtime_error("Final signature is invalid!");
+
+    return true;
+}
+
+/**
+ * @brief Prints the success rate, throughput and time spent in every stage.
+ */
+void print_report(const Options &options, const Statistics &stats,
+        std::chrono::steady_clock::duration wall)
+{
+    const double seconds = std::chrono::duration<double>(wall).count();
+    const double rounds = static_cast<double>(options.rounds);
+
+    std::int64_t total_ns = 0;
+    for (const auto &ns : stats.stage_ns)
+        total_ns += ns;
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Rounds: " << options.rounds
+              << ", unusable moduli: " << stats.moduli_failures << " ("
+              << 100.0 * static_cast<double>(stats.moduli_failures) / rounds
+              << "%), errors: " << stats.errors << '\n'
+              << "Wall time: " << seconds << " s, " << rounds / seconds
+              << " rounds/s\n"
+              << std::left << std::setw(16) << "stage" << std::right
+              << std::setw(14) << "total [s]" << std::setw(14) << "mean [ms]"
+              << std::setw(10) << "share" << '\n';
+
+    for (std::size_t i = 0; i < STAGE_COUNT; i++) {
+        const double ns = static_cast<double>(stats.stage_ns[i]);
+        std::cout << std::left << std::setw(16) << STAGE_NAMES[i] << std::right
+                  << std::setw(14) << ns / 1e9 << std::setw(14)
+                  << ns / 1e6 / rounds << std::setw(9)
+                  << (total_ns == 0 ? 0.0
+                                    : 100.0 * ns / static_cast<double>(total_ns))
+                  << "%\n";
+    }
+}
+
+/**
+ * @brief Main function of the stress test.
+ */
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Statistics stats;
+    std::mutex output_mutex;
+
+    const auto start = std::chrono::steady_clock::now();
+    run_parallel(options.rounds, options.jobs, [&](std::size_t i) {
+        const char *result = "\x1B[1;32mOK\x1B[0m";
+
+        try {
+            if (!run_round(stats)) {
+                stats.moduli_failures++;
+                result = "\x1B[1;33mUNUSABLE MODULI\x1B[0m";
+            }
+        } catch (const std::exception &e) {
+            stats.errors++;
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cerr << "ROUND " << i + 1 << ": \x1B[1;31mNOK\x1B[0m "
+                      << e.what() << '\n';
+            return;
+        }
+
+        if (options.verbose) {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << "ROUND " << i + 1 << ": " << result << '\n';
+        }
+    });
+    const auto wall = std::chrono::steady_clock::now() - start;
+
+    print_report(options, stats, wall);
+    return stats.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}